@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Per-frame bump allocator, reset at the top of each frame
+* Allocations that do not fit go to overflow blocks, the next reset
+* then replaces everything with a single block large enough for the
+* whole frame, so steady-state frames never touch the heap
+* Only trivially destructible types can live in the arena
+*/
+class Arena
+{
+public:
+	/* Heap allocations made by the arena since creation */
+	uint32_t heap_allocations = 0;
+
+	Arena(size_t capacity = 1 << 20) {
+		this->capacity = capacity;
+		block = (char*)malloc(capacity);
+		heap_allocations++;
+	}
+
+	~Arena() {
+		release_overflow();
+		free(block);
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	/* Bytes allocated since the last reset */
+	inline size_t used() const { return offset + overflow_bytes; }
+
+	inline void* alloc(size_t size, size_t align = 16) {
+		size_t start = (offset + align - 1) & ~(align - 1);
+		if (start + size <= capacity) {
+			offset = start + size;
+			return block + start;
+		}
+		/* Overflow block, the header links it for the next reset */
+		char* memory = (char*)malloc(size + align + sizeof(void*));
+		heap_allocations++;
+		*(char**)memory = overflow;
+		overflow = memory;
+		overflow_bytes += size + align;
+		uintptr_t p = ((uintptr_t)memory + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+		return (void*)p;
+	}
+
+	template <typename T>
+	inline T* alloc_array(size_t count) {
+		return (T*)alloc(sizeof(T) * count, alignof(T) > 16 ? alignof(T) : 16);
+	}
+
+	/* Free everything, growing the block if the last frame overflowed */
+	inline void reset() {
+		if (overflow != nullptr) {
+			size_t size = used() * 2;
+			release_overflow();
+			free(block);
+			capacity = size;
+			block = (char*)malloc(capacity);
+			heap_allocations++;
+		}
+		offset = 0;
+		overflow_bytes = 0;
+	}
+
+private:
+	char* block;
+	size_t capacity;
+	size_t offset = 0;
+	/* Linked list of overflow blocks */
+	char* overflow = nullptr;
+	size_t overflow_bytes = 0;
+
+	inline void release_overflow() {
+		while (overflow != nullptr) {
+			char* next = *(char**)overflow;
+			free(overflow);
+			overflow = next;
+		}
+	}
+};
+
+/*
+* Growable array backed by an arena, valid until the arena is reset
+* Growing copies into a twice larger allocation, the old one is
+* reclaimed by the next reset
+*/
+template <typename T>
+class ArenaArray
+{
+public:
+	T* data = nullptr;
+	int count = 0, capacity = 0;
+
+	ArenaArray(Arena& arena) { this->arena = &arena; }
+
+	inline int size() const { return count; }
+	inline T& operator[](int i) { return data[i]; }
+	inline const T& operator[](int i) const { return data[i]; }
+	inline T* begin() { return data; }
+	inline T* end() { return data + count; }
+	inline const T* begin() const { return data; }
+	inline const T* end() const { return data + count; }
+
+	inline void reserve(int n) {
+		if (n <= capacity)
+			return;
+		T* memory = arena->alloc_array<T>(n);
+		if (count > 0)
+			memcpy(memory, data, sizeof(T) * count);
+		data = memory;
+		capacity = n;
+	}
+
+	inline void push_back(const T& v) {
+		if (count == capacity)
+			reserve(capacity < 16 ? 16 : capacity * 2);
+		data[count++] = v;
+	}
+
+	inline void clear() { count = 0; }
+
+private:
+	Arena* arena;
+};
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "profile.h"
+#include "vec.h"
+#include "world.h"
+#include "terrain.h"
+#include "stream.h"
+#include "renderer.h"
+#include "console.h"
+#include "profiler.h"
+using namespace std;
+
+/*
+* Deterministic replay benchmark
+* Renders a fixed seed world headless along a scripted camera path,
+* then prints frame time percentiles and throughput as JSON
+*
+* Usage: benchmark [--frames n] [--warmup n] [--seed s] [--threads n] [--out file.json] [--trace file.json] [--grid]
+*                  [--edits n] [--raycast] [--distance d] [--lod d] [--sweep] [--size WxH] [--verify]
+* --edits breaks or places n random blocks around the camera every frame
+* --raycast renders by casting a ray per cell instead of rasterizing triangles
+* --distance sets the render distance, --lod the distance past which chunks
+*   are drawn as heightfields (0 draws every chunk at full detail)
+* --sweep compares the render paths at growing render distances, triangles
+*   at full detail and with levels of detail, and raycast
+* --size sets the frame size
+* --verify checks the batch vertex transform against the mat4x4 functions,
+*   batched ray casts against single ones, and the coverage of levels of
+*   detail against full detail, and exits non zero on a mismatch, without
+*   running the benchmark
+*/
+
+/* Benchmark settings */
+const int map_size = 1000;
+const int default_width = 192, default_height = 108;
+const size_t chunk_budget = 16 << 20;
+/* Render distance and frames of the level of detail check of --verify */
+const float lod_check_distance = 160.0f;
+const int lod_check_frames = 100;
+/* Render distances of --sweep */
+const float sweep_distances[] = { 20.0f, 40.0f, 80.0f, 160.0f, 240.0f };
+
+/* Scripted camera path, flies forward while slowly looking around */
+inline void camera_path(long frame, float camera_pos[4], float camera_rot[4]) {
+	vec3::init(50.0f, 26.0f, 50.0f + 0.3f * frame, camera_pos);
+	vec3::init(10.0f * sinf(frame * 0.02f), 40.0f * sinf(frame * 0.01f), 0.0f, camera_rot);
+}
+
+/* Nearest rank percentile of sorted values */
+inline double percentile(const vector<double>& sorted, double p) {
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+struct Options
+{
+	long frames = 1000, warmup = 10;
+	uint32_t seed = 1;
+	int threads = 0;
+	bool grid = false;
+	int edits = 0;
+	Renderer::Mode mode = Renderer::TRIANGLES;
+	float distance = render_distance;
+	float lod_distance = lod_start_distance;
+	int width = default_width, height = default_height;
+	bool trace = false;
+};
+
+struct Result
+{
+	/* Frame times in milliseconds, sorted */
+	vector<double> times;
+	double mean = 0.0, seconds = 0.0;
+	uint64_t triangles = 0;
+	uint32_t rebuilds = 0;
+	int threads = 0;
+	/* Time of each profiler zone over every frame */
+	profiler::Breakdown stages;
+};
+
+/* Render the camera path in a new world */
+void run(const Options& options, Result& result) {
+	/* Fixed seed world, streamed around the camera */
+	NoiseGenerator noise_generator(options.seed);
+	GridGenerator grid_generator(options.seed, ffloor(map_size / 10.0));
+	world::World chunks;
+	const world::Generator& generator = options.grid ? (const world::Generator&)grid_generator : noise_generator;
+	world::Streamer streamer(chunks, generator, chunk_budget);
+	Renderer renderer(chunks, options.width, options.height, options.threads);
+	renderer.mode = options.mode;
+	renderer.distance = options.distance;
+	renderer.lod_distance = options.lod_distance;
+	/* Every frame waits for its chunks, so the frames do not depend on timing */
+	auto stream = [&](const float camera_pos[4]) {
+		streamer.update(camera_pos, renderer.distance, [&](int cx, int cz) { renderer.forget(cx, cz); });
+		streamer.flush();
+		streamer.update(camera_pos, renderer.distance, [&](int cx, int cz) { renderer.forget(cx, cz); });
+	};
+	HeadlessConsole console(options.width, options.height);
+	float camera_pos[4], camera_rot[4];
+	profiler::Breakdown frame_stages;
+	/* Scripted edits, from their own xorshift state so they repeat with the seed */
+	vector<world::Edit> batch;
+	uint32_t edit_state = options.seed ? options.seed : 1;
+	auto edit = [&](const float camera_pos[4]) {
+		PROFILE_ZONE("edit");
+		batch.clear();
+		for (int i = 0; i < options.edits; i++) {
+			uint32_t r = edit_state = xorshift32(edit_state);
+			world::Edit e;
+			e.x = (int)camera_pos[0] + (int)(r % 33) - 16;
+			e.z = (int)camera_pos[2] + (int)((r >> 8) % 33) - 16;
+			e.y = (int)((r >> 16) % world::chunk_height);
+			e.block = (r >> 24) & 1 ? world::GROUND : world::AIR;
+			batch.push_back(e);
+		}
+		chunks.apply(batch);
+	};
+
+	/* Warm up the mesh cache and the frame arena */
+	for (long frame = 0; frame < options.warmup; frame++) {
+		camera_path(frame, camera_pos, camera_rot);
+		stream(camera_pos);
+		renderer.render(camera_pos, camera_rot);
+	}
+	profiler::frame_end(frame_stages);
+	if (options.trace)
+		profiler::trace_begin(16 * 1024 + options.frames * 64);
+
+	result.times.clear();
+	result.times.reserve(options.frames);
+	result.triangles = 0;
+	result.stages.clear();
+	uint32_t rebuilds = renderer.rebuilds();
+	PROF_COUNTER total("benchmark");
+	for (long frame = 0; frame < options.frames; frame++) {
+		PROF_COUNTER cnt0("frame-*");
+		{
+			PROFILE_ZONE("frame");
+			camera_path(frame, camera_pos, camera_rot);
+			stream(camera_pos);
+			if (options.edits)
+				edit(camera_pos);
+			renderer.render(camera_pos, camera_rot);
+			PROFILE_ZONE("present");
+			console.draw(renderer.buffer, renderer.stride);
+		}
+		result.times.push_back(cnt0.msecs());
+		result.triangles += renderer.triangles;
+		profiler::frame_end(frame_stages);
+		result.stages.accumulate(frame_stages);
+	}
+	result.seconds = total.msecs() / 1000.0;
+	result.rebuilds = renderer.rebuilds() - rebuilds;
+	result.threads = renderer.threads();
+
+	result.mean = 0.0;
+	for (double t : result.times)
+		result.mean += t;
+	result.mean /= result.times.size();
+	sort(result.times.begin(), result.times.end());
+}
+
+/*
+*  Batch transform against mat4x4 at a few frame sizes and camera
+*  rotations, with the projection the renderer uses
+*/
+bool verify_transform() {
+	const int sizes[][2] = { { default_width, default_height }, { 80, 24 }, { 317, 91 } };
+	const float angles[] = { 0.0f, 30.0f, 135.0f, -80.0f };
+	bool ok = true;
+	for (const int* size : sizes) {
+		float projection[16];
+		mat4x4::projection_matrix(fov, (float)size[1] / (float)size[0], zNear, zFar, projection);
+		for (float angle : angles) {
+			float rotation_x[16], rotation_y[16], view[16];
+			mat4x4::rotation_x(angle / 3.0f, rotation_x);
+			mat4x4::rotation_y(angle, rotation_y);
+			mat4x4::mult_mat(rotation_x, rotation_y, view);
+			if (!transform::verify(view, projection, size[0], size[1])) {
+				fprintf(stderr, "transform mismatch at %dx%d, rotation %.0f\n", size[0], size[1], angle);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+/*
+*  Batched ray casts over a thread pool against single casts, random rays
+*  through a fixed seed world, starting inside and around it
+*/
+bool verify_raycast() {
+	NoiseGenerator generator(1);
+	world::World chunks;
+	for (int cz = -4; cz < 4; cz++)
+		for (int cx = -4; cx < 4; cx++)
+			generator.generate(*chunks.create_chunk(cx, cz));
+
+	const int n = 100000;
+	vector<raycast::Ray> rays(n);
+	vector<raycast::Hit> hits(n);
+	uint32_t state = 1;
+	auto random = [&](float low, float high) {
+		state = xorshift32(state);
+		return low + (high - low) * (float)(state >> 8) / 16777216.0f;
+	};
+	for (raycast::Ray& ray : rays) {
+		ray.origin[0] = random(-80.0f, 80.0f);
+		ray.origin[1] = random(-8.0f, world::chunk_height + 8.0f);
+		ray.origin[2] = random(-80.0f, 80.0f);
+		for (int k = 0; k < 3; k++)
+			ray.dir[k] = random(-1.0f, 1.0f);
+		ray.max_distance = random(0.0f, 128.0f);
+	}
+	ThreadPool pool(4);
+	raycast::cast_batch(pool, chunks, rays.data(), hits.data(), n);
+
+	int mismatches = 0;
+	for (int i = 0; i < n; i++) {
+		raycast::Hit hit;
+		bool found = raycast::cast(chunks, rays[i].origin, rays[i].dir, rays[i].max_distance, hit);
+		const raycast::Hit& batch_hit = hits[i];
+		if (hit.block != batch_hit.block || hit.face != batch_hit.face || hit.distance != batch_hit.distance ||
+			(found && (hit.x != batch_hit.x || hit.y != batch_hit.y || hit.z != batch_hit.z)))
+			mismatches++;
+	}
+	if (mismatches)
+		fprintf(stderr, "raycast mismatch on %d of %d rays\n", mismatches, n);
+	return mismatches == 0;
+}
+
+/*
+*  Levels of detail against full detail along the camera path, the cells
+*  full detail draws that levels of detail leave blank. Heightfields are
+*  never below the blocks, so only a few silhouette cells may be lost,
+*  and no crack: a lost cell whose four neighbours are drawn
+*/
+bool verify_lod() {
+	NoiseGenerator generator(1);
+	world::World chunks;
+	world::Streamer streamer(chunks, generator, chunk_budget);
+	Renderer full(chunks, default_width, default_height, 1), lod(chunks, default_width, default_height, 1);
+	full.distance = lod.distance = lod_check_distance;
+	full.lod_distance = 0.0f;
+	lod.lod_distance = lod_start_distance;
+	auto forget = [&](int cx, int cz) {
+		full.forget(cx, cz);
+		lod.forget(cx, cz);
+	};
+	long drawn = 0, lost = 0, cracks = 0;
+	for (int frame = 0; frame < lod_check_frames; frame++) {
+		float camera_pos[4], camera_rot[4];
+		camera_path(3 * frame, camera_pos, camera_rot);
+		streamer.update(camera_pos, lod_check_distance, forget);
+		streamer.flush();
+		streamer.update(camera_pos, lod_check_distance, forget);
+		full.render(camera_pos, camera_rot);
+		lod.render(camera_pos, camera_rot);
+		for (int y = 0; y < full.height; y++) {
+			for (int x = 0; x < full.width; x++) {
+				const int i = y * full.stride + x;
+				if (full.buffer[i] == L' ')
+					continue;
+				drawn++;
+				if (lod.buffer[i] != L' ')
+					continue;
+				lost++;
+				bool enclosed = x > 0 && x + 1 < full.width && y > 0 && y + 1 < full.height &&
+					lod.buffer[i - 1] != L' ' && lod.buffer[i + 1] != L' ' &&
+					lod.buffer[i - lod.stride] != L' ' && lod.buffer[i + lod.stride] != L' ';
+				cracks += enclosed;
+			}
+		}
+	}
+	/* At most 1 cell in 1000 */
+	bool ok = cracks == 0 && lost * 1000 <= drawn;
+	fprintf(ok ? stdout : stderr, "levels of detail lose %ld of %ld cells, %ld cracks\n", lost, drawn, cracks);
+	return ok;
+}
+
+inline const char* mode_name(Renderer::Mode mode) { return mode == Renderer::RAYCAST ? "raycast" : "triangles"; }
+
+inline void print_frame_ms(FILE* file, const Result& r) {
+	fprintf(file, "\"frame_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+		r.mean, percentile(r.times, 50), percentile(r.times, 95), percentile(r.times, 99), r.times.back());
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	const char* out = nullptr;
+	const char* trace = nullptr;
+	bool sweep = false;
+	bool verify = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--grid") == 0)
+			options.grid = true;
+		else if (strcmp(argv[i], "--raycast") == 0)
+			options.mode = Renderer::RAYCAST;
+		else if (strcmp(argv[i], "--sweep") == 0)
+			sweep = true;
+		else if (strcmp(argv[i], "--verify") == 0)
+			verify = true;
+		else if (i + 1 == argc)
+			break;
+		else if (strcmp(argv[i], "--frames") == 0)
+			options.frames = atol(argv[++i]);
+		else if (strcmp(argv[i], "--warmup") == 0)
+			options.warmup = atol(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0)
+			options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--threads") == 0)
+			options.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--out") == 0)
+			out = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0)
+			trace = argv[++i];
+		else if (strcmp(argv[i], "--edits") == 0)
+			options.edits = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--distance") == 0)
+			options.distance = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--lod") == 0)
+			options.lod_distance = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--size") == 0) {
+			i++;
+			if (sscanf(argv[i], "%dx%d", &options.width, &options.height) != 2 || options.width < 1 || options.height < 1) {
+				options.width = default_width;
+				options.height = default_height;
+			}
+		}
+	}
+	if (verify) {
+		bool transform_ok = verify_transform();
+		printf("transform %s\n", transform_ok ? "ok" : "mismatch");
+		bool raycast_ok = verify_raycast();
+		printf("raycast %s\n", raycast_ok ? "ok" : "mismatch");
+		bool lod_ok = verify_lod();
+		printf("lod %s\n", lod_ok ? "ok" : "mismatch");
+		return transform_ok && raycast_ok && lod_ok ? 0 : 1;
+	}
+	if (options.frames < 1)
+		options.frames = 1;
+
+	FILE* file = out ? fopen(out, "w") : stdout;
+	if (file == nullptr) {
+		fprintf(stderr, "cannot open %s\n", out);
+		return 1;
+	}
+	Result result;
+	fprintf(file, "{\n");
+	fprintf(file, "  \"seed\": %u,\n", options.seed);
+	fprintf(file, "  \"terrain\": \"%s\",\n", options.grid ? "grid" : "noise");
+	fprintf(file, "  \"frames\": %ld,\n", options.frames);
+	fprintf(file, "  \"width\": %d,\n", options.width);
+	fprintf(file, "  \"height\": %d,\n", options.height);
+	if (sweep) {
+		/* Full detail and level of detail triangles, then raycast, at each distance, in a new world every run */
+		const int count = sizeof(sweep_distances) / sizeof(sweep_distances[0]);
+		const float lod_distance = options.lod_distance > 0.0f ? options.lod_distance : lod_start_distance;
+		fprintf(file, "  \"sweep\": [\n");
+		for (int i = 0; i < 3 * count; i++) {
+			options.distance = sweep_distances[i / 3];
+			options.mode = i % 3 == 2 ? Renderer::RAYCAST : Renderer::TRIANGLES;
+			options.lod_distance = i % 3 == 1 ? lod_distance : 0.0f;
+			run(options, result);
+			fprintf(file, "    { \"mode\": \"%s\", \"render_distance\": %.0f, \"lod_distance\": %.0f, \"threads\": %d, ",
+				mode_name(options.mode), options.distance, options.lod_distance, result.threads);
+			print_frame_ms(file, result);
+			fprintf(file, ", \"triangles_per_frame\": %.1f }%s\n",
+				(double)result.triangles / options.frames, i + 1 < 3 * count ? "," : "");
+		}
+		fprintf(file, "  ]\n");
+		fprintf(file, "}\n");
+		if (out)
+			fclose(file);
+		return 0;
+	}
+
+	options.trace = trace != nullptr;
+	run(options, result);
+	fprintf(file, "  \"mode\": \"%s\",\n", mode_name(options.mode));
+	fprintf(file, "  \"render_distance\": %.1f,\n", options.distance);
+	fprintf(file, "  \"lod_distance\": %.1f,\n", options.lod_distance);
+	fprintf(file, "  \"threads\": %d,\n", result.threads);
+	fprintf(file, "  ");
+	print_frame_ms(file, result);
+	fprintf(file, ",\n");
+	/* Milliseconds per frame of each profiler zone */
+	const profiler::Breakdown& stages = result.stages;
+	fprintf(file, "  \"stages_ms\": {");
+	for (int i = 0; i < stages.count; i++)
+		fprintf(file, "%s \"%s\": %.4f", i ? "," : "", stages.entries[i].name, stages.entries[i].msecs / stages.frames);
+	fprintf(file, " },\n");
+	fprintf(file, "  \"dropped_zones\": %u,\n", stages.dropped);
+	fprintf(file, "  \"edits_per_frame\": %d,\n", options.edits);
+	fprintf(file, "  \"mesh_rebuilds\": %u,\n", result.rebuilds);
+	fprintf(file, "  \"triangles\": %llu,\n", (unsigned long long)result.triangles);
+	fprintf(file, "  \"triangles_per_second\": %.0f,\n", result.triangles / result.seconds);
+	fprintf(file, "  \"total_seconds\": %.4f\n", result.seconds);
+	fprintf(file, "}\n");
+	if (out)
+		fclose(file);
+	if (trace && !profiler::write_trace(trace)) {
+		fprintf(stderr, "cannot write %s\n", trace);
+		return 1;
+	}
+	return 0;
+}
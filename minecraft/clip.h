@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+* Homogeneous clip space polygon clipping (Sutherland-Hodgman)
+*/
+namespace clip {
+
+	/* Clip planes: near (z >= 0), then the left, right, bottom and top screen edges */
+	const int plane_count = 5;
+	/* A triangle gains at most one vertex per clip plane */
+	const int max_vertices = 3 + plane_count;
+
+	/*
+	* Fixed capacity convex polygon, vertices in clip space (x, y, z, w)
+	*/
+	struct Polygon
+	{
+		int count;
+		float v[max_vertices][4];
+	};
+
+	/* Signed distance of a vertex to a clip plane, >= 0 inside */
+	inline float distance(const float v[4], int plane) {
+		switch (plane) {
+		case 0: return v[2];
+		case 1: return v[3] + v[0];
+		case 2: return v[3] - v[0];
+		case 3: return v[3] + v[1];
+		default: return v[3] - v[1];
+		}
+	}
+
+	/* Bit mask of the clip planes a vertex is outside of */
+	inline uint8_t outcode(const float v[4]) {
+		uint8_t code = 0;
+		for (int plane = 0; plane < plane_count; plane++)
+			if (distance(v, plane) < 0.0f)
+				code |= 1 << plane;
+		return code;
+	}
+
+	/* Clip a polygon against one plane */
+	inline void clip_plane(const Polygon& in, int plane, Polygon& out) {
+		out.count = 0;
+		for (int i = 0; i < in.count; i++) {
+			const float* a = in.v[i];
+			const float* b = in.v[(i + 1) % in.count];
+			float da = distance(a, plane), db = distance(b, plane);
+			if (da >= 0.0f) {
+				for (int k = 0; k < 4; k++)
+					out.v[out.count][k] = a[k];
+				out.count++;
+			}
+			/*
+			*  Edge crosses the plane, emit the intersection. It is always computed
+			*  from the inside vertex, so the triangles sharing the edge get the same point
+			*/
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				const float* in_v = da >= 0.0f ? a : b;
+				const float* out_v = da >= 0.0f ? b : a;
+				float d_in = da >= 0.0f ? da : db, d_out = da >= 0.0f ? db : da;
+				float t = d_in / (d_in - d_out);
+				for (int k = 0; k < 4; k++)
+					out.v[out.count][k] = in_v[k] + t * (out_v[k] - in_v[k]);
+				out.count++;
+			}
+		}
+	}
+
+	/*
+	*  Clip a clip space triangle against the near plane and the screen edges
+	*  Returns the number of vertices of the clipped polygon, < 3 if nothing is left
+	*/
+	inline int clip_triangle(const float a[4], const float b[4], const float c[4], Polygon& out) {
+		uint8_t ca = outcode(a), cb = outcode(b), cc = outcode(c);
+		out.count = 0;
+		/* All vertices outside of the same plane */
+		if (ca & cb & cc)
+			return 0;
+
+		for (int k = 0; k < 4; k++) {
+			out.v[0][k] = a[k];
+			out.v[1][k] = b[k];
+			out.v[2][k] = c[k];
+		}
+		out.count = 3;
+
+		/* Only clip against the planes that are crossed */
+		uint8_t crossed = ca | cb | cc;
+		Polygon tmp;
+		for (int plane = 0; plane < plane_count && out.count >= 3; plane++) {
+			if (crossed & (1 << plane)) {
+				clip_plane(out, plane, tmp);
+				out = tmp;
+			}
+		}
+		return out.count;
+	}
+
+	/*
+	*  Map a clipped vertex to screen coordinates (x, y, 1/w)
+	*  Cell (x, y) spans [x, x + 1) x [y, y + 1), positions keep their fraction
+	*  and are only clamped to the screen edges
+	*/
+	inline void viewport(const float v[4], int width, int height, float out[3]) {
+		float iw = 1.0f / v[3];
+		float x = (v[0] * iw + 1.0f) * (width * 0.5f);
+		float y = (1.0f - v[1] * iw) * (height * 0.5f);
+		out[0] = fminf(fmaxf(x, 0.0f), (float)width);
+		out[1] = fminf(fmaxf(y, 0.0f), (float)height);
+		out[2] = iw;
+	}
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+using namespace std;
+
+/* Colors of the cells, by the level of their char in the shade ramp */
+enum ColorMode { MONO, COLOR_256, TRUECOLOR };
+
+/* Best color mode the terminal advertises, through COLORTERM and TERM */
+inline ColorMode detect_color_mode() {
+	const char* colorterm = getenv("COLORTERM");
+	if (colorterm && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0))
+		return TRUECOLOR;
+	const char* term = getenv("TERM");
+	if (term && strstr(term, "256color"))
+		return COLOR_256;
+	return MONO;
+}
+
+/*
+* Output backend, presents the char buffer of each frame
+*/
+class Console
+{
+public:
+	int width, height;
+
+	Console(int width, int height) {
+		this->width = width;
+		this->height = height;
+	}
+	virtual ~Console() {}
+
+	/* Present height rows of width chars, rows start stride chars apart */
+	virtual void draw(const wchar_t* buffer, int stride) = 0;
+	/* Set the window title, when there is one */
+	virtual void title(const char*) {}
+
+	/* Change the size of the frames drawn next */
+	virtual void resize(int width, int height) {
+		this->width = width;
+		this->height = height;
+	}
+
+	/* Size of the window in cells, false if it has none or it is unknown */
+	virtual bool window_size(int&, int&) { return false; }
+};
+
+/*
+* Headless backend, keeps the last frame in memory and
+* optionally dumps every nth frame to <prefix><frame>.txt
+*/
+class HeadlessConsole : public Console
+{
+public:
+	/* Last presented frame, one char per cell */
+	string frame;
+	uint32_t frames = 0;
+
+	HeadlessConsole(int width, int height, const char* prefix = nullptr, int every = 1) : Console(width, height) {
+		frame.resize(width * height);
+		this->prefix = prefix ? prefix : "";
+		this->every = every < 1 ? 1 : every;
+	}
+
+	void draw(const wchar_t* buffer, int stride) override {
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				frame[y * width + x] = (char)buffer[y * stride + x];
+		if (prefix.size() && frames % every == 0)
+			dump();
+		frames++;
+	}
+
+	void resize(int width, int height) override {
+		Console::resize(width, height);
+		frame.assign(width * height, ' ');
+	}
+
+private:
+	string prefix;
+	int every;
+
+	void dump() {
+		char path[512];
+		snprintf(path, sizeof(path), "%s%05u.txt", prefix.c_str(), frames);
+		FILE* file = fopen(path, "wb");
+		if (file == nullptr)
+			return;
+		for (int y = 0; y < height; y++) {
+			fwrite(&frame[y * width], 1, width, file);
+			fputc('\n', file);
+		}
+		fclose(file);
+	}
+};
+
+#ifdef _WIN32
+/* Enables the process to read data from the buffer */
+#define READ 0x80000000L
+/* Enables the process to write data to the buffer */
+#define WRITE 0x40000000L
+/* Enables console buffer mode */
+#define BUFFER_MODE 0x1
+
+/*
+* Windows console backend
+*/
+class WindowsConsole : public Console
+{
+public:
+	/* Console Font Size */
+	const uint8_t font_size = 8;
+
+	/*
+	* Creates console, sets up the buffer and the dimensions
+	* Enables acces rights and inputs for the console
+	*/
+	WindowsConsole(int width, int height) : Console(width, height) {
+		/* Initialize console screen buffer, enabling reading, writing and buffer mode */
+		hConsoleHandle = CreateConsoleScreenBuffer(READ | WRITE, 0, NULL, BUFFER_MODE, NULL);
+
+		/* Init console window info using minimal size (1,1) */
+		SMALL_RECT lpConsoleWindow = { 0, 0, 1, 1 };
+		SetConsoleWindowInfo(hConsoleHandle, TRUE, &lpConsoleWindow);
+
+		/* Set console screen buffer size */
+		COORD dwSize = { (short)width, (short)height };
+		SetConsoleScreenBufferSize(hConsoleHandle, dwSize);
+
+		/* Activate Screen Buffer */
+		SetConsoleActiveScreenBuffer(hConsoleHandle);
+
+		/* Set Console Font settings */
+		CONSOLE_FONT_INFOEX lpCurrentConsoleFontEx;
+		lpCurrentConsoleFontEx.cbSize = sizeof(lpCurrentConsoleFontEx);
+		lpCurrentConsoleFontEx.nFont = 0;
+		lpCurrentConsoleFontEx.dwFontSize.X = font_size;
+		lpCurrentConsoleFontEx.dwFontSize.Y = font_size;
+		lpCurrentConsoleFontEx.FontFamily = FF_DONTCARE;
+		lpCurrentConsoleFontEx.FontWeight = FW_NORMAL;
+		SetCurrentConsoleFontEx(hConsoleHandle, false, &lpCurrentConsoleFontEx);
+
+		/* Set Physical Console Window Size */
+		lpConsoleWindow = { 0, 0, (short)width - 1, (short)height - 1 };
+		SetConsoleWindowInfo(hConsoleHandle, TRUE, &lpConsoleWindow);
+
+		/* Enable console mouse and keyboard input */
+		SetConsoleMode(hConsoleHandle, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT);
+	}
+
+	void draw(const wchar_t* buffer, int stride) override {
+		DWORD bytesWritten = 0;
+		if (stride == width) {
+			WriteConsoleOutputCharacter(hConsoleHandle, buffer, width * height, { 0, 0 }, &bytesWritten);
+			return;
+		}
+		for (int y = 0; y < height; y++)
+			WriteConsoleOutputCharacter(hConsoleHandle, buffer + y * stride, width, { 0, (short)y }, &bytesWritten);
+	}
+
+	void resize(int width, int height) override {
+		Console::resize(width, height);
+		/* Shrink the window first, the buffer may not be smaller than it */
+		SMALL_RECT lpConsoleWindow = { 0, 0, 1, 1 };
+		SetConsoleWindowInfo(hConsoleHandle, TRUE, &lpConsoleWindow);
+		COORD dwSize = { (short)width, (short)height };
+		SetConsoleScreenBufferSize(hConsoleHandle, dwSize);
+		lpConsoleWindow = { 0, 0, (short)width - 1, (short)height - 1 };
+		SetConsoleWindowInfo(hConsoleHandle, TRUE, &lpConsoleWindow);
+	}
+
+	void title(const char* title) override {
+		SetConsoleTitleA(title);
+	}
+
+private:
+	HANDLE hConsoleHandle;
+};
+#else
+/*
+* POSIX terminal backend, ANSI escapes on stdout
+* Frames are double buffered, only the runs of cells that changed since
+* the previous frame are written, and each frame is a single write()
+* With colors, the chars of the shade ramp are drawn in a matching
+* brightness, the escape of each char comes from a table and is only
+* written when the color changes
+*/
+class TerminalConsole : public Console
+{
+public:
+	/* Bytes written by the last draw */
+	size_t last_bytes = 0;
+
+	/* ramp lists the shade chars darkest first, it is needed for colors */
+	TerminalConsole(int width, int height, ColorMode color = MONO, const char* ramp = nullptr) : Console(width, height) {
+		/* Worst case, every cell plus a cursor move per row, and a color per cell */
+		output.reserve((width + 16) * height + (color != MONO ? 20 * width * height : 0) + 256);
+		previous.assign(width * height, '\0');
+		set_colors(color, ramp);
+		/* Clear screen, hide cursor */
+		write_all("\033[2J\033[?25l", 10);
+	}
+
+	~TerminalConsole() {
+		/* Move below the frame, reset colors, show cursor */
+		char escape[40];
+		int n = snprintf(escape, sizeof(escape), "\033[%d;1H\033[0m\033[?25h\n", height);
+		write_all(escape, n);
+	}
+
+	void draw(const wchar_t* buffer, int stride) override {
+		output.clear();
+		for (int y = 0; y < height; y++) {
+			const wchar_t* row = buffer + y * stride;
+			char* old = &previous[y * width];
+			/* Column the cursor is at, -1 when it has to be moved */
+			int cursor = -1;
+			for (int x = 0; x < width; x++) {
+				if ((char)row[x] == old[x])
+					continue;
+				/* Rewriting a short gap of unchanged cells is cheaper than moving the cursor */
+				if (cursor >= 0 && x - cursor <= max_gap) {
+					for (int k = cursor; k < x; k++)
+						put(old[k]);
+				}
+				else {
+					char escape[24];
+					int n = snprintf(escape, sizeof(escape), "\033[%d;%dH", y + 1, x + 1);
+					output.append(escape, n);
+				}
+				old[x] = (char)row[x];
+				put(old[x]);
+				cursor = x + 1;
+			}
+		}
+		if (pending_title.size()) {
+			output.append("\033]0;");
+			output.append(pending_title);
+			output.push_back('\007');
+			pending_title.clear();
+		}
+		last_bytes = output.size();
+		write_all(output.data(), output.size());
+	}
+
+	/* Sent with the next frame */
+	void title(const char* title) override {
+		if (current_title != title) {
+			current_title.assign(title);
+			pending_title.assign(title);
+		}
+	}
+
+	/* Clears the screen, every cell is drawn again by the next frame */
+	void resize(int width, int height) override {
+		Console::resize(width, height);
+		output.reserve((width + 16) * height + (color != MONO ? 20 * width * height : 0) + 256);
+		write_all("\033[0m\033[2J", 8);
+		invalidate();
+	}
+
+	/* Size of the terminal, from the tty of stdout */
+	bool window_size(int& width, int& height) override {
+		struct winsize size;
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0 || size.ws_row == 0)
+			return false;
+		width = size.ws_col;
+		height = size.ws_row;
+		return true;
+	}
+
+	/* Redraw every cell on the next frame */
+	inline void invalidate() {
+		previous.assign(width * height, '\0');
+		current_color = -1;
+	}
+
+	/*
+	*  Build the color escape of each char, chars outside of the ramp use
+	*  the default color. 256 colors use the grey ramp, truecolor tints it
+	*/
+	void set_colors(ColorMode color, const char* ramp) {
+		this->color = ramp ? color : MONO;
+		memset(cell_color, 0, sizeof(cell_color));
+		escapes[0] = "\033[39m";
+		int levels = ramp ? (int)strlen(ramp) : 0;
+		for (int level = 1; level < levels && level < max_colors; level++) {
+			float k = (float)level / (levels - 1);
+			char escape[24];
+			if (color == TRUECOLOR)
+				snprintf(escape, sizeof(escape), "\033[38;2;%d;%d;%dm", (int)(60 + 170 * k), (int)(70 + 185 * k), (int)(50 + 150 * k));
+			else
+				snprintf(escape, sizeof(escape), "\033[38;5;%dm", 232 + (int)(23 * k + 0.5f));
+			escapes[level] = escape;
+			cell_color[(uint8_t)ramp[level]] = (uint8_t)level;
+		}
+		invalidate();
+	}
+
+private:
+	/* Longest run of unchanged cells rewritten instead of moving the cursor */
+	const int max_gap = 8;
+	string output;
+	/* Frame shown on the terminal */
+	string previous;
+	string current_title, pending_title;
+	/* Color escape of each char, by index in escapes, and the color the terminal is set to */
+	static const int max_colors = 32;
+	ColorMode color = MONO;
+	uint8_t cell_color[256];
+	string escapes[max_colors];
+	int current_color = -1;
+
+	inline void put(char c) {
+		if (color != MONO) {
+			int index = cell_color[(uint8_t)c];
+			if (index != current_color) {
+				output.append(escapes[index]);
+				current_color = index;
+			}
+		}
+		output.push_back(c);
+	}
+
+	inline void write_all(const char* data, size_t size) {
+		while (size > 0) {
+			ssize_t n = ::write(STDOUT_FILENO, data, size);
+			if (n <= 0)
+				return;
+			data += n;
+			size -= n;
+		}
+	}
+};
+#endif
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "world.h"
+#include "terrain.h"
+#include "region.h"
+using namespace std;
+
+/*
+* Map converter
+* Builds the map array the way the game used to, from the random grid,
+* and writes it to a region directory that the game opens with --world
+*
+* Usage: convert <directory> [--seed s] [--size n]
+*/
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: convert <directory> [--seed s] [--size n]\n");
+		return 1;
+	}
+	const char* directory = argv[1];
+	uint32_t seed = 1;
+	int map_size = 1000;
+	for (int i = 2; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--seed") == 0)
+			seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--size") == 0)
+			map_size = atoi(argv[++i]);
+	}
+
+	/* Grid cells and map columns per side, ffloor is an unparenthesized macro, keep it out of expressions */
+	const int cells = ffloor(map_size / 10.0), size = cells * 10;
+	/* generate_grid advances the seed, keep the original for the level file */
+	uint32_t state = seed;
+	int* grid = generate_grid(state, cells);
+	int* map = interpolate_grid(grid, cells);
+	world::World chunks;
+	chunks.load_heightmap(map, size);
+	delete[] grid;
+	delete[] map;
+
+	/*
+	*  Chunks on the map edge also cover columns past it, fill those
+	*  from the grid terrain the game generates around the map
+	*/
+	GridGenerator fallback(seed, cells);
+	uint8_t blocks[world::chunk_volume], generated[world::chunk_volume];
+	for (auto& it : chunks.chunks) {
+		world::Chunk* c = it.second;
+		const int x0 = c->cx * world::chunk_size, z0 = c->cz * world::chunk_size;
+		if (x0 + world::chunk_size <= size && z0 + world::chunk_size <= size)
+			continue;
+		world::Chunk edge(c->cx, c->cz);
+		fallback.generate(edge);
+		edge.read(generated);
+		c->read(blocks);
+		for (int i = 0; i < world::chunk_volume; i++) {
+			const int x = i % world::chunk_size, z = i / world::chunk_size % world::chunk_size;
+			if (x0 + x >= size || z0 + z >= size)
+				blocks[i] = generated[i];
+		}
+		c->write(blocks);
+	}
+
+	region::Store store(directory);
+	/* The game generates the chunks past the map with the same grid terrain */
+	region::Level level;
+	level.seed = seed;
+	level.terrain = region::Level::GRID;
+	level.map_size = map_size;
+	if (!store.write_level(level)) {
+		fprintf(stderr, "cannot write to %s\n", directory);
+		return 1;
+	}
+	int saved = store.save(chunks);
+	printf("%d chunks written to %s\n", saved, directory);
+	return saved == (int)chunks.chunks.size() ? 0 : 1;
+}
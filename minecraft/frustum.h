@@ -0,0 +1,57 @@
+#pragma once
+
+#include <math.h>
+
+/**
+* View frustum culling
+*/
+namespace frustum {
+
+	/* Plane indexes */
+	enum { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE };
+
+	/*
+	*  Extract the six planes (a, b, c, d) of a view projection matrix,
+	*  points p with a*p.x + b*p.y + c*p.z + d >= 0 are on the inner side
+	*  Row vector convention of mat4x4::mult_vec, clip.i = column i of mat
+	*/
+	inline void planes(const float mat[16], float out[6][4]) {
+		for (int i = 0; i < 4; i++) {
+			const float x = mat[4 * i], y = mat[4 * i + 1], z = mat[4 * i + 2], w = mat[4 * i + 3];
+			out[LEFT][i] = w + x;
+			out[RIGHT][i] = w - x;
+			out[BOTTOM][i] = w + y;
+			out[TOP][i] = w - y;
+			out[NEAR_PLANE][i] = z;
+			out[FAR_PLANE][i] = w - z;
+		}
+	}
+
+	/* Whether an axis aligned box is at least partially inside the frustum */
+	inline bool aabb_visible(const float planes[6][4], const float min[3], const float max[3]) {
+		for (int i = 0; i < 6; i++) {
+			const float* p = planes[i];
+			/* Corner of the box the furthest along the plane normal */
+			float x = p[0] >= 0.0f ? max[0] : min[0];
+			float y = p[1] >= 0.0f ? max[1] : min[1];
+			float z = p[2] >= 0.0f ? max[2] : min[2];
+			if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	/* Bounding box of n points */
+	inline void bounds(const float points[][4], int n, float min[3], float max[3]) {
+		for (int j = 0; j < 3; j++) {
+			min[j] = points[0][j];
+			max[j] = points[0][j];
+		}
+		for (int i = 1; i < n; i++) {
+			for (int j = 0; j < 3; j++) {
+				min[j] = fminf(min[j], points[i][j]);
+				max[j] = fmaxf(max[j], points[i][j]);
+			}
+		}
+	}
+}
@@ -0,0 +1,801 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include "world.h"
+using namespace std;
+
+/**
+* Chunk meshing, builds and caches the visible faces of each chunk
+*/
+namespace mesh {
+
+	/* Cube vertices */
+	const float vertices[8][4] = {{0.5, -0.5, -0.5, 1.0}, {0.5, -0.5, 0.5, 1.0}, {-0.5, -0.5, 0.5, 1.0}, {-0.5, -0.5, -0.5, 1.0}, {0.5, 0.5, -0.5, 1.0}, {0.5, 0.5, 0.5, 1.0}, {-0.5, 0.5, 0.5, 1.0}, {-0.5, 0.5, -0.5, 1.0}};
+	/* Normals of the six faces of the cube */
+	const float normals[6][4] = {{0.0, -1.0, 0.0, 1.0}, {0.0, 1.0, 0.0, 1.0}, {1.0, 0.0, 0.0, 1.0}, {0.0, 0.0, 1.0, 1.0}, {-1.0, 0.0, 0.0, 1.0}, {0.0, 0.0, -1.0, 1.0}};
+	/* Faces created from point indexes, split in (0, 1, 2) and (0, 2, 3) triangles */
+	const int face_quads[6][4] = {{0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 5, 4}, {1, 2, 6, 5}, {2, 3, 7, 6}, {3, 0, 4, 7}};
+	/* Neighbour offset of each face */
+	const int face_offsets[6][3] = {{0, -1, 0}, {0, 1, 0}, {1, 0, 0}, {0, 0, 1}, {-1, 0, 0}, {0, 0, -1}};
+
+	/* In-plane (u, v) axes of each face, 0 = x, 1 = y, 2 = z */
+	const int face_axes[6][2] = {{0, 2}, {0, 2}, {2, 1}, {0, 1}, {2, 1}, {0, 1}};
+
+	/*
+	* Levels of detail, level 0 is the block mesh, level l > 0 a heightfield
+	* of 2^l x 2^l column cells, the last level is one cell per chunk
+	*/
+	const int lod_levels = 5;
+
+	/*
+	*  Level of detail of a chunk distance blocks away, full detail within
+	*  lod_distance, then one level more every time the distance doubles
+	*  lod_distance <= 0 keeps every chunk at full detail
+	*/
+	inline int lod_level(float distance, float lod_distance) {
+		if (lod_distance <= 0.0f || distance < lod_distance)
+			return 0;
+		int level = 1;
+		for (float d = 2.0f * lod_distance; distance >= d && level < lod_levels - 1; d *= 2.0f)
+			level++;
+		return level;
+	}
+
+	/*
+	* Visible face of a block at (x, y, z), facing direction dir
+	* Merged faces cover w blocks along their u axis and h along v
+	* A split face is drawn as its outline, see split_edges
+	*/
+	struct Face
+	{
+		int32_t x, z;
+		int16_t y;
+		uint8_t dir, block;
+		uint8_t w, h;
+		/* Number of outline points, 0 for a plain quad */
+		uint16_t outline = 0;
+	};
+
+	/* World space corners of a face */
+	inline void face_corners(const Face& face, float out[4][4]) {
+		const int u = face_axes[face.dir][0], v = face_axes[face.dir][1];
+		for (int i = 0; i < 4; i++) {
+			const float* c = vertices[face_quads[face.dir][i]];
+			out[i][0] = face.x + c[0];
+			out[i][1] = face.y + c[1];
+			out[i][2] = face.z + c[2];
+			out[i][3] = 1.0f;
+			if (c[u] > 0.0f)
+				out[i][u] += face.w - 1;
+			if (c[v] > 0.0f)
+				out[i][v] += face.h - 1;
+		}
+	}
+
+	/* Offset in blocks along the u and v axes of corner i of a face, see face_corners */
+	inline void corner_offset(const Face& face, int i, int& a, int& b) {
+		const float* c = vertices[face_quads[face.dir][i]];
+		a = c[face_axes[face.dir][0]] > 0.0f ? face.w : 0;
+		b = c[face_axes[face.dir][1]] > 0.0f ? face.h : 0;
+	}
+
+	/* World space point of a face, a blocks along its u axis and b along v from its first corner */
+	inline void face_point(const Face& face, float a, float b, float out[4]) {
+		const int u = face_axes[face.dir][0], v = face_axes[face.dir][1], n = 3 - u - v;
+		out[0] = face.x - 0.5f;
+		out[1] = face.y - 0.5f;
+		out[2] = face.z - 0.5f;
+		out[3] = 1.0f;
+		out[u] += a;
+		out[v] += b;
+		if (face_offsets[face.dir][n] > 0)
+			out[n] += 1.0f;
+	}
+
+	/* Whether a block covered by the face is within d of (x, z) on both axes */
+	inline bool face_in_range(const Face& face, float x, float z, float d) {
+		const int u = face_axes[face.dir][0], v = face_axes[face.dir][1];
+		float max_x = face.x + (u == 0 ? face.w - 1 : 0);
+		float max_z = face.z + (u == 2 ? face.w - 1 : (v == 2 ? face.h - 1 : 0));
+		return max_x >= x - d && face.x <= x + d && max_z >= z - d && face.z <= z + d;
+	}
+
+	/*
+	*  Blocks of a face within d of (x, z) on both axes, as the rectangle
+	*  [a0, a1] x [b0, b1] of offsets from its first corner, see face_point
+	*  A merged face crossing the distance is cut to the same blocks as
+	*  unit faces. Returns false when the rectangle is the whole face
+	*/
+	inline bool face_clamp(const Face& face, float x, float z, float d, int& a0, int& b0, int& a1, int& b1) {
+		const int u = face_axes[face.dir][0], v = face_axes[face.dir][1];
+		const int position[3] = { face.x, face.y, face.z };
+		auto clamp = [&](int axis, int& low, int& high) {
+			if (axis == 1)
+				return;
+			float center = axis == 0 ? x : z;
+			int first = (int)ceilf(center - d) - position[axis], last = (int)floorf(center + d) + 1 - position[axis];
+			low = low > first ? low : first;
+			high = high < last ? high : last;
+		};
+		a0 = 0;
+		b0 = 0;
+		a1 = face.w;
+		b1 = face.h;
+		clamp(u, a0, a1);
+		clamp(v, b0, b1);
+		return a0 != 0 || b0 != 0 || a1 != face.w || b1 != face.h;
+	}
+
+	/*
+	* Cached face list of a chunk, with the revisions of the chunk
+	* and its four neighbours (0 if missing) it was built from
+	*/
+	class ChunkMesh
+	{
+	public:
+		vector<Face> faces;
+		/* (a, b) offsets of the outline points of the split faces, in face order */
+		vector<uint8_t> outlines;
+		/* Number of block faces before merging */
+		uint32_t unit_faces = 0;
+		uint32_t revisions[5] = { 0, 0, 0, 0, 0 };
+	};
+
+	/*
+	*  Revisions of a chunk, and of the side of each horizontal neighbour
+	*  facing it, +x, -x, +z, -z in that order
+	*  Edits inside a neighbour do not change the mesh, only its side does
+	*/
+	inline void chunk_revisions(const world::World& w, const world::Chunk* chunk, uint32_t out[5]) {
+		const world::Chunk* n;
+		out[0] = chunk->revision;
+		out[1] = (n = w.chunk(chunk->cx + 1, chunk->cz)) ? n->side_revisions[0] : 0;
+		out[2] = (n = w.chunk(chunk->cx - 1, chunk->cz)) ? n->side_revisions[1] : 0;
+		out[3] = (n = w.chunk(chunk->cx, chunk->cz + 1)) ? n->side_revisions[2] : 0;
+		out[4] = (n = w.chunk(chunk->cx, chunk->cz - 1)) ? n->side_revisions[3] : 0;
+	}
+
+	/*
+	* Copy of every block a chunk mesh depends on: the chunk, and the side
+	* of each neighbour facing it (AIR when the neighbour is not loaded)
+	* Meshes are built from a snapshot, so building never reads the world
+	*/
+	class Snapshot
+	{
+	public:
+		int cx, cz;
+		uint32_t revisions[5];
+		/* Chunk blocks, unpacked by Chunk::read */
+		uint8_t blocks[world::chunk_volume];
+		/* Neighbour sides +x, -x, +z, -z, indexed [y][z] for x sides and [y][x] for z sides */
+		uint8_t sides[4][world::chunk_height * world::chunk_size];
+
+		/* Copy a chunk and its neighbour sides, O(chunk_volume) */
+		void take(const world::World& w, const world::Chunk* chunk) {
+			const int last = world::chunk_mask;
+			cx = chunk->cx;
+			cz = chunk->cz;
+			chunk_revisions(w, chunk, revisions);
+			chunk->read(blocks);
+			const world::Chunk* n[4] = { w.chunk(cx + 1, cz), w.chunk(cx - 1, cz), w.chunk(cx, cz + 1), w.chunk(cx, cz - 1) };
+			for (int s = 0; s < 4; s++) {
+				if (n[s] == nullptr) {
+					memset(sides[s], world::AIR, sizeof(sides[s]));
+					continue;
+				}
+				for (int y = 0; y < world::chunk_height; y++) {
+					for (int i = 0; i < world::chunk_size; i++) {
+						uint8_t& out = sides[s][y * world::chunk_size + i];
+						if (s == 0)
+							out = n[s]->get(0, y, i);
+						else if (s == 1)
+							out = n[s]->get(last, y, i);
+						else if (s == 2)
+							out = n[s]->get(i, y, 0);
+						else
+							out = n[s]->get(i, y, last);
+					}
+				}
+			}
+		}
+	};
+
+	/*
+	*  Block whose face dir is visible (touches air), AIR if hidden
+	*  Faces below the bottom of the world are never visible
+	*/
+	inline uint8_t visible_block(const Snapshot& s, int x, int y, int z, int dir) {
+		uint8_t block = s.blocks[(y * world::chunk_size + z) * world::chunk_size + x];
+		if (block == world::AIR)
+			return world::AIR;
+		int nx = x + face_offsets[dir][0], ny = y + face_offsets[dir][1], nz = z + face_offsets[dir][2];
+		uint8_t neighbour;
+		if (ny < 0)
+			neighbour = block;
+		else if (ny >= world::chunk_height)
+			neighbour = world::AIR;
+		else if (nx >= world::chunk_size)
+			neighbour = s.sides[0][ny * world::chunk_size + nz];
+		else if (nx < 0)
+			neighbour = s.sides[1][ny * world::chunk_size + nz];
+		else if (nz >= world::chunk_size)
+			neighbour = s.sides[2][ny * world::chunk_size + nx];
+		else if (nz < 0)
+			neighbour = s.sides[3][ny * world::chunk_size + nx];
+		else
+			neighbour = s.blocks[(ny * world::chunk_size + nz) * world::chunk_size + nx];
+		return neighbour == world::AIR ? block : world::AIR;
+	}
+
+	/* Emit every face of the chunk that touches air, O(chunk_volume) */
+	inline uint32_t build(const Snapshot& s, vector<Face>& out) {
+		out.clear();
+		const int ox = s.cx * world::chunk_size, oz = s.cz * world::chunk_size;
+		for (int y = 0; y < world::chunk_height; y++) {
+			for (int z = 0; z < world::chunk_size; z++) {
+				for (int x = 0; x < world::chunk_size; x++) {
+					for (int dir = 0; dir < 6; dir++) {
+						uint8_t block = visible_block(s, x, y, z, dir);
+						if (block == world::AIR)
+							continue;
+						Face face;
+						face.x = ox + x;
+						face.y = (int16_t)y;
+						face.z = oz + z;
+						face.dir = (uint8_t)dir;
+						face.block = block;
+						face.w = 1;
+						face.h = 1;
+						out.push_back(face);
+					}
+				}
+			}
+		}
+		return (uint32_t)out.size();
+	}
+
+	/*
+	*  Greedy meshing, merges adjacent coplanar faces of the same block
+	*  into rectangles, slice by slice along each face direction
+	*  Returns the number of block faces before merging
+	*/
+	inline uint32_t build_greedy(const Snapshot& s, vector<Face>& out) {
+		const int dims[3] = { world::chunk_size, world::chunk_height, world::chunk_size };
+		const int ox = s.cx * world::chunk_size, oz = s.cz * world::chunk_size;
+		uint8_t mask[world::chunk_size * (world::chunk_height > world::chunk_size ? world::chunk_height : world::chunk_size)];
+		uint32_t unit_faces = 0;
+		out.clear();
+		for (int dir = 0; dir < 6; dir++) {
+			const int u = face_axes[dir][0], v = face_axes[dir][1], n = 3 - u - v;
+			const int du = dims[u], dv = dims[v];
+			for (int d = 0; d < dims[n]; d++) {
+				/* Visible faces of the slice */
+				int pos[3];
+				pos[n] = d;
+				for (int j = 0; j < dv; j++) {
+					for (int i = 0; i < du; i++) {
+						pos[u] = i;
+						pos[v] = j;
+						mask[j * du + i] = visible_block(s, pos[0], pos[1], pos[2], dir);
+						unit_faces += mask[j * du + i] != world::AIR;
+					}
+				}
+
+				/* Merge them into rectangles */
+				for (int j = 0; j < dv; j++) {
+					for (int i = 0; i < du;) {
+						uint8_t block = mask[j * du + i];
+						if (block == world::AIR) {
+							i++;
+							continue;
+						}
+						int fw = 1, fh = 1;
+						while (i + fw < du && mask[j * du + i + fw] == block)
+							fw++;
+						for (bool grow = true; grow && j + fh < dv; ) {
+							for (int k = 0; k < fw; k++) {
+								if (mask[(j + fh) * du + i + k] != block) {
+									grow = false;
+									break;
+								}
+							}
+							if (grow)
+								fh++;
+						}
+						for (int l = 0; l < fh; l++)
+							memset(mask + (j + l) * du + i, world::AIR, fw);
+
+						pos[u] = i;
+						pos[v] = j;
+						Face face;
+						face.x = ox + pos[0];
+						face.y = (int16_t)pos[1];
+						face.z = oz + pos[2];
+						face.dir = (uint8_t)dir;
+						face.block = block;
+						face.w = (uint8_t)fw;
+						face.h = (uint8_t)fh;
+						out.push_back(face);
+						i += fw;
+					}
+				}
+			}
+		}
+		return unit_faces;
+	}
+
+	/*
+	*  T-junction removal. A merged face whose edge passes through a corner
+	*  of another face is split there: it is drawn as its outline, with the
+	*  corner inserted, so both faces share the same vertices along the edge
+	*  and rasterize without cracks
+	*  Edges on the chunk border are split at every block, the corners of
+	*  the neighbour chunk faces along them are not known here
+	*/
+	inline void split_edges(const Snapshot& s, vector<Face>& faces, vector<uint8_t>& outlines) {
+		const int size = world::chunk_size + 1, height = world::chunk_height + 1;
+		const int ox = s.cx * world::chunk_size, oz = s.cz * world::chunk_size;
+		/* Corners of every face, on the (chunk_size + 1)^2 x (chunk_height + 1) lattice */
+		vector<uint8_t> corners(size * size * height, 0);
+		auto lattice = [&](const Face& face, int a, int b, int p[3]) {
+			float point[4];
+			face_point(face, (float)a, (float)b, point);
+			p[0] = (int)(point[0] + 0.5f) - ox;
+			p[1] = (int)(point[1] + 0.5f);
+			p[2] = (int)(point[2] + 0.5f) - oz;
+		};
+		auto index = [&](const int p[3]) { return (p[1] * size + p[2]) * size + p[0]; };
+		for (const Face& face : faces) {
+			for (int i = 0; i < 4; i++) {
+				int a, b, p[3];
+				corner_offset(face, i, a, b);
+				lattice(face, a, b, p);
+				corners[index(p)] = 1;
+			}
+		}
+
+		outlines.clear();
+		for (Face& face : faces) {
+			face.outline = 0;
+			if (face.w == 1 && face.h == 1)
+				continue;
+			size_t start = outlines.size();
+			bool split = false;
+			for (int i = 0; i < 4; i++) {
+				int a0, b0, a1, b1, p0[3], p1[3];
+				corner_offset(face, i, a0, b0);
+				corner_offset(face, (i + 1) % 4, a1, b1);
+				lattice(face, a0, b0, p0);
+				lattice(face, a1, b1, p1);
+				bool border = (p0[0] == p1[0] && (p0[0] == 0 || p0[0] == world::chunk_size)) ||
+					(p0[2] == p1[2] && (p0[2] == 0 || p0[2] == world::chunk_size));
+				outlines.push_back((uint8_t)a0);
+				outlines.push_back((uint8_t)b0);
+				const int da = a1 > a0 ? 1 : (a1 < a0 ? -1 : 0), db = b1 > b0 ? 1 : (b1 < b0 ? -1 : 0);
+				for (int a = a0 + da, b = b0 + db; a != a1 || b != b1; a += da, b += db) {
+					int p[3];
+					lattice(face, a, b, p);
+					if (border || corners[index(p)]) {
+						outlines.push_back((uint8_t)a);
+						outlines.push_back((uint8_t)b);
+						split = true;
+					}
+				}
+			}
+			if (split)
+				face.outline = (uint16_t)((outlines.size() - start) / 2);
+			else
+				outlines.resize(start);
+		}
+	}
+
+	/*
+	*  Heightfield mesh of a chunk, for the levels of detail past 0
+	*  Columns are grouped in cells of 2^level x 2^level, each cell is a
+	*  solid column up to the highest block it covers, so it is never below
+	*  the blocks, drawn as its top and the sides rising above its neighbour
+	*  cells, both merged into rectangles
+	*  On the chunk border the sides go down to the solid floor of the
+	*  neighbour columns, which a neighbour drawn at any level covers, so
+	*  there is no crack between chunks of different levels
+	*  The rectangles meet at T-junctions, mesh_snapshot splits them like
+	*  greedy faces, see split_edges
+	*  Returns the number of faces
+	*/
+	inline uint32_t build_heightfield(const Snapshot& s, int level, vector<Face>& out) {
+		const int size = 1 << level, cells = world::chunk_size >> level;
+		const int ox = s.cx * world::chunk_size, oz = s.cz * world::chunk_size;
+		/* Height of each cell, -1 when empty, and its top block */
+		int heights[world::chunk_size * world::chunk_size];
+		uint8_t tops[world::chunk_size * world::chunk_size];
+		out.clear();
+		for (int j = 0; j < cells; j++) {
+			for (int i = 0; i < cells; i++) {
+				int h = -1;
+				uint8_t top = world::AIR;
+				for (int z = j * size; z < (j + 1) * size; z++) {
+					for (int x = i * size; x < (i + 1) * size; x++) {
+						/* Only the blocks above the highest one found so far */
+						for (int y = world::chunk_height - 1; y > h; y--) {
+							uint8_t block = s.blocks[(y * world::chunk_size + z) * world::chunk_size + x];
+							if (block != world::AIR) {
+								h = y;
+								top = block;
+								break;
+							}
+						}
+					}
+				}
+				heights[j * cells + i] = h;
+				tops[j * cells + i] = top;
+			}
+		}
+
+		/* Top of the blocks solid from the bottom up in the neighbour columns along each cell, +x, -x, +z, -z */
+		int floors[4][world::chunk_size];
+		for (int n = 0; n < 4; n++) {
+			for (int t = 0; t < cells; t++) {
+				int f = world::chunk_height - 1;
+				for (int c = t * size; c < (t + 1) * size; c++) {
+					int y = 0;
+					while (y <= f && s.sides[n][y * world::chunk_size + c] != world::AIR)
+						y++;
+					f = y - 1;
+				}
+				floors[n][t] = f;
+			}
+		}
+
+		/* Sides, the cells of a row facing the same way merge when they span the same blocks */
+		for (int dir = 2; dir < 6; dir++) {
+			const bool along_z = dir == 2 || dir == 4;
+			const int border = dir == 2 ? 0 : dir == 4 ? 1 : dir == 3 ? 2 : 3;
+			auto span = [&](int r, int t, int& low, int& high) {
+				int i = along_z ? r : t, j = along_z ? t : r;
+				int ni = i + face_offsets[dir][0], nj = j + face_offsets[dir][2];
+				bool inside = ni >= 0 && ni < cells && nj >= 0 && nj < cells;
+				high = heights[j * cells + i];
+				low = (inside ? heights[nj * cells + ni] : floors[border][t]) + 1;
+			};
+			for (int r = 0; r < cells; r++) {
+				for (int t = 0; t < cells;) {
+					int low, high;
+					span(r, t, low, high);
+					int run = 1, next_low, next_high;
+					while (t + run < cells && (span(r, t + run, next_low, next_high), next_low == low && next_high == high))
+						run++;
+					if (low <= high) {
+						int i = along_z ? r : t, j = along_z ? t : r;
+						Face face;
+						face.x = ox + i * size + (dir == 2 ? size - 1 : 0);
+						face.y = (int16_t)low;
+						face.z = oz + j * size + (dir == 3 ? size - 1 : 0);
+						face.dir = (uint8_t)dir;
+						face.block = tops[j * cells + i];
+						face.w = (uint8_t)(run * size);
+						face.h = (uint8_t)(high - low + 1);
+						out.push_back(face);
+					}
+					t += run;
+				}
+			}
+		}
+
+		/* Tops, cells of the same height merged into rectangles */
+		for (int j = 0; j < cells; j++) {
+			for (int i = 0; i < cells;) {
+				int h = heights[j * cells + i];
+				if (h < 0) {
+					i++;
+					continue;
+				}
+				int fw = 1, fh = 1;
+				while (i + fw < cells && heights[j * cells + i + fw] == h)
+					fw++;
+				for (bool grow = true; grow && j + fh < cells; ) {
+					for (int k = 0; k < fw; k++) {
+						if (heights[(j + fh) * cells + i + k] != h) {
+							grow = false;
+							break;
+						}
+					}
+					if (grow)
+						fh++;
+				}
+				for (int l = 0; l < fh; l++)
+					for (int k = 0; k < fw; k++)
+						heights[(j + l) * cells + i + k] = -1;
+
+				Face face;
+				face.x = ox + i * size;
+				face.y = (int16_t)h;
+				face.z = oz + j * size;
+				face.dir = 1;
+				face.block = tops[j * cells + i];
+				face.w = (uint8_t)(fw * size);
+				face.h = (uint8_t)(fh * size);
+				out.push_back(face);
+				i += fw;
+			}
+		}
+		return (uint32_t)out.size();
+	}
+
+	/*
+	* Chunk meshes, built on first use and rebuilt only when the blocks of
+	* the chunk, or the sides of its neighbours facing it, change
+	* Each level of detail is cached apart, and built only when a chunk is
+	* first drawn at it
+	* In background mode the render thread only snapshots the chunk, a
+	* builder thread meshes it, and the previous mesh is drawn until
+	* collect picks up the new one
+	*/
+	class MeshCache
+	{
+	public:
+		/* Meshes of each level of detail */
+		unordered_map<uint64_t, ChunkMesh> meshes[lod_levels];
+		/* Number of meshes built since creation */
+		uint32_t rebuilds = 0;
+		/* Merge coplanar faces, see build_greedy */
+		bool greedy;
+
+		MeshCache(bool greedy = false) { this->greedy = greedy; }
+
+		~MeshCache() {
+			set_background(false);
+			for (Job* job : spare)
+				delete job;
+		}
+
+		MeshCache(const MeshCache&) = delete;
+		MeshCache& operator=(const MeshCache&) = delete;
+
+		/* Switch meshing mode, dropping the cached meshes */
+		inline void set_greedy(bool greedy) {
+			if (this->greedy == greedy)
+				return;
+			/* Restart the builder so no mesh of the old mode is installed */
+			bool was_background = background();
+			set_background(false);
+			meshes[0].clear();
+			this->greedy = greedy;
+			set_background(was_background);
+		}
+
+		/* Build meshes on a background thread, or synchronously in get */
+		void set_background(bool background) {
+			if (background == builder.joinable())
+				return;
+			if (background) {
+				stop = false;
+				builder = thread(&MeshCache::work, this);
+				return;
+			}
+			{
+				lock_guard<mutex> lock(m);
+				stop = true;
+			}
+			requested.notify_all();
+			builder.join();
+			/* Drop the unfinished work, the meshes are requested again */
+			for (Job* job : queue)
+				spare.push_back(job);
+			queue.clear();
+			collect();
+		}
+
+		inline bool background() const { return builder.joinable(); }
+
+		/*
+		*  Mesh of a chunk, call from the render thread
+		*  In background mode a stale or empty mesh is returned while the
+		*  chunk is rebuilt, at most one rebuild of a chunk and level is in flight
+		*  level is the level of detail, see lod_level
+		*/
+		inline const ChunkMesh& get(const world::World& w, const world::Chunk* chunk, int level = 0) {
+			uint64_t key = world::chunk_key(chunk->cx, chunk->cz);
+			ChunkMesh& mesh = meshes[level][key];
+			uint32_t revisions[5];
+			chunk_revisions(w, chunk, revisions);
+			if (memcmp(revisions, mesh.revisions, sizeof(revisions)) == 0)
+				return mesh;
+			if (!background()) {
+				scratch.take(w, chunk);
+				mesh.unit_faces = mesh_snapshot(scratch, level, mesh.faces, mesh.outlines, greedy);
+				memcpy(mesh.revisions, revisions, sizeof(revisions));
+				rebuilds++;
+				return mesh;
+			}
+			if (pending[level].count(key))
+				return built(mesh, key, level);
+			Job* job;
+			{
+				lock_guard<mutex> lock(m);
+				job = spare.size() ? spare.back() : nullptr;
+				if (job)
+					spare.pop_back();
+			}
+			if (job == nullptr)
+				job = new Job();
+			job->key = key;
+			job->level = level;
+			job->sequence = ++sequence;
+			job->snapshot.take(w, chunk);
+			pending[level][key] = job->sequence;
+			{
+				lock_guard<mutex> lock(m);
+				queue.push_back(job);
+			}
+			requested.notify_one();
+			return built(mesh, key, level);
+		}
+
+		/* Install the meshes built in the background, call from the render thread */
+		void collect() {
+			{
+				lock_guard<mutex> lock(m);
+				finished.swap(done);
+			}
+			for (Job* job : finished) {
+				auto it = pending[job->level].find(job->key);
+				/* Skip results of chunks erased since they were requested */
+				if (it != pending[job->level].end() && it->second == job->sequence) {
+					pending[job->level].erase(it);
+					ChunkMesh& mesh = meshes[job->level][job->key];
+					mesh.faces.swap(job->faces);
+					mesh.outlines.swap(job->outlines);
+					mesh.unit_faces = job->unit_faces;
+					memcpy(mesh.revisions, job->snapshot.revisions, sizeof(mesh.revisions));
+					rebuilds++;
+				}
+			}
+			lock_guard<mutex> lock(m);
+			for (Job* job : finished)
+				spare.push_back(job);
+			finished.clear();
+			/* Requests dropped by set_background(false) */
+			if (!builder.joinable())
+				for (int level = 0; level < lod_levels; level++)
+					pending[level].clear();
+		}
+
+		/* Block until the builder is done with every requested mesh, and install them, call from the render thread */
+		void flush() {
+			if (background()) {
+				unique_lock<mutex> lock(m);
+				idle.wait(lock, [this] { return queue.empty() && active == 0; });
+			}
+			collect();
+		}
+
+		/* Drop the cached meshes of a chunk, at every level */
+		inline void erase(int cx, int cz) {
+			uint64_t key = world::chunk_key(cx, cz);
+			for (int level = 0; level < lod_levels; level++) {
+				meshes[level].erase(key);
+				pending[level].erase(key);
+			}
+		}
+
+		/*
+		*  Drop the meshes of the chunks more than radius chunks away from
+		*  chunk (cx, cz) on the x or z axis, they are built again when the
+		*  chunk comes back in range
+		*  The streamer budget only counts blocks, this keeps the meshes to
+		*  the chunks around the camera
+		*/
+		void evict_far(int cx, int cz, int radius) {
+			for (int level = 0; level < lod_levels; level++) {
+				for (auto it = meshes[level].begin(); it != meshes[level].end();) {
+					const int mx = (int)(uint32_t)(it->first >> 32), mz = (int)(uint32_t)it->first;
+					if (abs(mx - cx) > radius || abs(mz - cz) > radius) {
+						pending[level].erase(it->first);
+						it = meshes[level].erase(it);
+					}
+					else
+						it++;
+				}
+			}
+		}
+
+		/* Bytes used by the cached meshes */
+		size_t memory() const {
+			size_t bytes = 0;
+			for (int level = 0; level < lod_levels; level++)
+				for (auto& it : meshes[level])
+					bytes += sizeof(it) + it.second.faces.capacity() * sizeof(Face) + it.second.outlines.capacity();
+			return bytes;
+		}
+
+	private:
+		struct Job
+		{
+			uint64_t key;
+			int level;
+			uint32_t sequence;
+			uint32_t unit_faces;
+			vector<Face> faces;
+			vector<uint8_t> outlines;
+			Snapshot snapshot;
+		};
+
+		/* Render thread only, sequence of the rebuild in flight of each chunk, per level */
+		unordered_map<uint64_t, uint32_t> pending[lod_levels];
+		uint32_t sequence = 0;
+		vector<Job*> finished;
+		/* Snapshot of synchronous builds */
+		Snapshot scratch;
+
+		/* Shared with the builder, guarded by m */
+		mutex m;
+		condition_variable requested, idle;
+		bool stop = false;
+		/* Jobs the builder is working on */
+		int active = 0;
+		deque<Job*> queue;
+		vector<Job*> done;
+		/* Finished jobs, reused with their face lists */
+		vector<Job*> spare;
+		thread builder;
+
+		/*
+		*  A mesh never built yet is drawn from the nearest level the chunk
+		*  has, so a chunk changing level does not disappear while it is built
+		*/
+		inline const ChunkMesh& built(const ChunkMesh& mesh, uint64_t key, int level) {
+			if (mesh.revisions[0] != 0)
+				return mesh;
+			for (int d = 1; d < lod_levels; d++) {
+				for (int l : { level - d, level + d }) {
+					if (l < 0 || l >= lod_levels)
+						continue;
+					auto it = meshes[l].find(key);
+					if (it != meshes[l].end() && it->second.revisions[0] != 0)
+						return it->second;
+				}
+			}
+			return mesh;
+		}
+
+		/* Mesh of a snapshot at a level of detail, merged faces are split at T-junctions */
+		static inline uint32_t mesh_snapshot(const Snapshot& s, int level, vector<Face>& out, vector<uint8_t>& outlines, bool merge) {
+			uint32_t unit_faces;
+			if (level > 0)
+				unit_faces = build_heightfield(s, level, out);
+			else
+				unit_faces = merge ? build_greedy(s, out) : build(s, out);
+			split_edges(s, out, outlines);
+			return unit_faces;
+		}
+
+		void work() {
+			unique_lock<mutex> lock(m);
+			while (1) {
+				requested.wait(lock, [this] { return stop || queue.size(); });
+				if (stop)
+					return;
+				Job* job = queue.front();
+				queue.pop_front();
+				active++;
+				bool merge = greedy;
+				lock.unlock();
+				job->unit_faces = mesh_snapshot(job->snapshot, job->level, job->faces, job->outlines, merge);
+				lock.lock();
+				done.push_back(job);
+				active--;
+				if (queue.empty() && active == 0)
+					idle.notify_all();
+			}
+		}
+	};
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NOISE_AVX2
+#endif
+
+/**
+* Seeded 2D gradient noise (improved Perlin) and fractal sums of it
+* Defined for any coordinate, without a precomputed grid
+*/
+namespace noise {
+
+	/* Gradient directions, indexed by the low 3 bits of the lattice hash */
+	const float gradient_x[8] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f };
+	const float gradient_z[8] = { 1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f };
+
+	/* Quintic fade curve, 6t^5 - 15t^4 + 10t^3 */
+	inline float fade(float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+
+	/*
+	* Gradient noise of a seed, values are in [-1, 1]
+	* Octave sums (fBm) are evaluated one sample at a time, or 8 at a time with AVX2
+	*/
+	class Perlin
+	{
+	public:
+		/* Octaves, frequency multiplier and amplitude multiplier of each octave */
+		int octaves = 4;
+		float lacunarity = 2.0f, gain = 0.5f;
+
+		Perlin(uint32_t seed) { this->seed = seed; }
+
+		/* Single octave at (x, z) */
+		inline float sample(float x, float z) const {
+			float fx = floorf(x), fz = floorf(z);
+			int xi = (int)fx, zi = (int)fz;
+			float xf = x - fx, zf = z - fz;
+			float u = fade(xf), v = fade(zf);
+
+			float n00 = grad(hash(xi, zi), xf, zf), n10 = grad(hash(xi + 1, zi), xf - 1.0f, zf);
+			float n01 = grad(hash(xi, zi + 1), xf, zf - 1.0f), n11 = grad(hash(xi + 1, zi + 1), xf - 1.0f, zf - 1.0f);
+
+			float nx0 = n00 + u * (n10 - n00), nx1 = n01 + u * (n11 - n01);
+			return nx0 + v * (nx1 - nx0);
+		}
+
+		/* Sum of octaves at (x, z), normalized back to [-1, 1] */
+		inline float fbm(float x, float z) const {
+			float sum = 0.0f, amplitude = 1.0f, total = 0.0f;
+			for (int i = 0; i < octaves; i++) {
+				sum += amplitude * sample(x, z);
+				total += amplitude;
+				x *= lacunarity;
+				z *= lacunarity;
+				amplitude *= gain;
+			}
+			return sum / total;
+		}
+
+		/* fbm of n samples, 8 per instruction with AVX2 */
+		inline void fbm(const float* x, const float* z, int n, float* out) const {
+			int i = 0;
+#if defined(NOISE_AVX2)
+			for (; i + 8 <= n; i += 8)
+				_mm256_storeu_ps(out + i, fbm8(_mm256_loadu_ps(x + i), _mm256_loadu_ps(z + i)));
+#endif
+			for (; i < n; i++)
+				out[i] = fbm(x[i], z[i]);
+		}
+
+	private:
+		uint32_t seed;
+
+		/*
+		*  Hash of a lattice point and the seed, the full 32 bit coordinates
+		*  are mixed in, so the gradients do not repeat along either axis
+		*/
+		inline uint32_t hash(int x, int z) const {
+			uint32_t h = seed ^ ((uint32_t)x * 0x8da6b343u) ^ ((uint32_t)z * 0xd8163841u);
+			h ^= h >> 16;
+			h *= 0x7feb352du;
+			h ^= h >> 15;
+			h *= 0x846ca68bu;
+			h ^= h >> 16;
+			return h;
+		}
+
+		static inline float grad(uint32_t hash, float x, float z) {
+			return gradient_x[hash & 7] * x + gradient_z[hash & 7] * z;
+		}
+
+#if defined(NOISE_AVX2)
+		/* sample, for 8 points */
+		inline __m256 sample8(__m256 x, __m256 z) const {
+			const __m256 one = _mm256_set1_ps(1.0f), six = _mm256_set1_ps(6.0f);
+			const __m256 fifteen = _mm256_set1_ps(15.0f), ten = _mm256_set1_ps(10.0f);
+			const __m256i seven = _mm256_set1_epi32(7), step = _mm256_set1_epi32(1);
+
+			__m256 fx = _mm256_floor_ps(x), fz = _mm256_floor_ps(z);
+			__m256i xi = _mm256_cvttps_epi32(fx), zi = _mm256_cvttps_epi32(fz);
+			__m256i xi1 = _mm256_add_epi32(xi, step), zi1 = _mm256_add_epi32(zi, step);
+			__m256 xf = _mm256_sub_ps(x, fx), zf = _mm256_sub_ps(z, fz);
+			__m256 xf1 = _mm256_sub_ps(xf, one), zf1 = _mm256_sub_ps(zf, one);
+			__m256 u = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(xf, xf), xf),
+				_mm256_add_ps(_mm256_mul_ps(xf, _mm256_sub_ps(_mm256_mul_ps(xf, six), fifteen)), ten));
+			__m256 v = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(zf, zf), zf),
+				_mm256_add_ps(_mm256_mul_ps(zf, _mm256_sub_ps(_mm256_mul_ps(zf, six), fifteen)), ten));
+
+			__m256i h00 = _mm256_and_si256(hash8(xi, zi), seven), h10 = _mm256_and_si256(hash8(xi1, zi), seven);
+			__m256i h01 = _mm256_and_si256(hash8(xi, zi1), seven), h11 = _mm256_and_si256(hash8(xi1, zi1), seven);
+
+			__m256 n00 = grad8(h00, xf, zf), n10 = grad8(h10, xf1, zf);
+			__m256 n01 = grad8(h01, xf, zf1), n11 = grad8(h11, xf1, zf1);
+			__m256 nx0 = _mm256_add_ps(n00, _mm256_mul_ps(u, _mm256_sub_ps(n10, n00)));
+			__m256 nx1 = _mm256_add_ps(n01, _mm256_mul_ps(u, _mm256_sub_ps(n11, n01)));
+			return _mm256_add_ps(nx0, _mm256_mul_ps(v, _mm256_sub_ps(nx1, nx0)));
+		}
+
+		/* hash, for 8 lattice points */
+		inline __m256i hash8(__m256i x, __m256i z) const {
+			__m256i h = _mm256_xor_si256(_mm256_set1_epi32((int)seed), _mm256_xor_si256(
+				_mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x8da6b343u)), _mm256_mullo_epi32(z, _mm256_set1_epi32((int)0xd8163841u))));
+			h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+			h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x7feb352du));
+			h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+			h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x846ca68bu));
+			return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+		}
+
+		static inline __m256 grad8(__m256i hash, __m256 x, __m256 z) {
+			__m256 gx = _mm256_i32gather_ps(gradient_x, hash, 4), gz = _mm256_i32gather_ps(gradient_z, hash, 4);
+			return _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gz, z));
+		}
+
+		/* fbm, for 8 points */
+		inline __m256 fbm8(__m256 x, __m256 z) const {
+			const __m256 lacunarity8 = _mm256_set1_ps(lacunarity);
+			__m256 sum = _mm256_setzero_ps();
+			float amplitude = 1.0f, total = 0.0f;
+			for (int i = 0; i < octaves; i++) {
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), sample8(x, z)));
+				total += amplitude;
+				x = _mm256_mul_ps(x, lacunarity8);
+				z = _mm256_mul_ps(z, lacunarity8);
+				amplitude *= gain;
+			}
+			return _mm256_div_ps(sum, _mm256_set1_ps(total));
+		}
+#endif
+	};
+}
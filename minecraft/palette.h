@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Array of byte values stored as indexes into a local palette
+* Indexes are bit-packed with 1, 2, 4 or 8 bits each, the smallest width
+* that fits the palette, so an index never straddles two words
+* Adding a value to a full palette repacks the array at twice the width
+* The palette only grows, pack rebuilds it from the values in use
+*/
+class PaletteArray
+{
+public:
+	/* count must be a multiple of 64 */
+	PaletteArray(int count, uint8_t value = 0) {
+		this->count = count;
+		fill(value);
+	}
+
+	~PaletteArray() { free(words); }
+
+	PaletteArray(const PaletteArray&) = delete;
+	PaletteArray& operator=(const PaletteArray&) = delete;
+
+	/* Bits per index, and distinct values in the palette */
+	inline int index_bits() const { return bits; }
+	inline int palette_size() const { return size; }
+
+	/* Heap bytes used by the indexes and the palette */
+	inline size_t memory() const { return allocation(bits); }
+
+	inline uint8_t get(int i) const {
+		int bit = i << shift;
+		return palette[(words[bit >> 6] >> (bit & 63)) & mask()];
+	}
+
+	inline void set(int i, uint8_t value) {
+		int index = find(value);
+		if (index < 0) {
+			if (size == 1 << bits)
+				repack(shift + 1);
+			index = size;
+			palette[size++] = value;
+		}
+		int bit = i << shift;
+		uint64_t& word = words[bit >> 6];
+		word = (word & ~(mask() << (bit & 63))) | ((uint64_t)index << (bit & 63));
+	}
+
+	/* Set every value, back to 1 bit indexes */
+	inline void fill(uint8_t value) {
+		allocate(0);
+		memset(words, 0, (size_t)count / 8);
+		palette[0] = value;
+		size = 1;
+	}
+
+	/* Decode every value, out holds count bytes */
+	inline void unpack(uint8_t* out) const {
+		const int per_word = 64 >> shift;
+		const uint64_t m = mask();
+		for (int w = 0; w < (count >> 6 << shift); w++) {
+			uint64_t word = words[w];
+			for (int k = 0; k < per_word; k++, word >>= bits)
+				*out++ = palette[word & m];
+		}
+	}
+
+	/* Replace every value, the palette is rebuilt with only the values used */
+	inline void pack(const uint8_t* in) {
+		int16_t index[256];
+		uint8_t values[256];
+		memset(index, 0xff, sizeof(index));
+		int n = 0;
+		for (int i = 0; i < count; i++)
+			if (index[in[i]] < 0) {
+				index[in[i]] = (int16_t)n;
+				values[n++] = in[i];
+			}
+		int s = 0;
+		while ((1 << (1 << s)) < n)
+			s++;
+		allocate(s);
+		memcpy(palette, values, n);
+		size = n;
+		const int per_word = 64 >> shift;
+		for (int w = 0; w < (count >> 6 << shift); w++) {
+			uint64_t word = 0;
+			for (int k = per_word - 1; k >= 0; k--)
+				word = (word << bits) | (uint64_t)index[in[w * per_word + k]];
+			words[w] = word;
+		}
+	}
+
+private:
+	int count;
+	/* bits = 1 << shift */
+	int shift = -1, bits = 0;
+	int size = 0;
+	/* Indexes, followed by the palette in the same allocation */
+	uint64_t* words = nullptr;
+	uint8_t* palette = nullptr;
+
+	inline uint64_t mask() const { return ((uint64_t)1 << bits) - 1; }
+
+	inline size_t allocation(int bits) const { return (size_t)count * bits / 8 + ((size_t)1 << bits); }
+
+	inline int find(uint8_t value) const {
+		for (int i = 0; i < size; i++)
+			if (palette[i] == value)
+				return i;
+		return -1;
+	}
+
+	/* Switch to 1 << shift bit indexes, the contents are undefined */
+	inline void allocate(int shift) {
+		if (shift != this->shift) {
+			free(words);
+			words = (uint64_t*)malloc(allocation(1 << shift));
+			this->shift = shift;
+			bits = 1 << shift;
+			palette = (uint8_t*)words + (size_t)count * bits / 8;
+		}
+	}
+
+	/* Widen the indexes, keeping the values */
+	inline void repack(int shift) {
+		const int old_bits = bits;
+		uint64_t* old = words;
+		const uint64_t old_mask = mask();
+		uint8_t old_palette[256];
+		memcpy(old_palette, palette, size);
+		words = nullptr;
+		this->shift = -1;
+		allocate(shift);
+		memcpy(palette, old_palette, size);
+		memset(words, 0, (size_t)count * bits / 8);
+		for (int i = 0; i < count; i++) {
+			int old_bit = i * old_bits, bit = i << shift;
+			uint64_t index = (old[old_bit >> 6] >> (old_bit & 63)) & old_mask;
+			words[bit >> 6] |= index << (bit & 63);
+		}
+		free(old);
+	}
+};
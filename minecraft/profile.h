@@ -35,6 +35,7 @@
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <math.h>
 using namespace std;
 
 /**
@@ -129,9 +130,12 @@ public:
         return (std::to_string(round(1.0 / (this->SinceStart<DURATION>().count() / 1e9))) + " FPS");
     }
 
-    int time() 
+    /**
+     * @return the elapsed time in whole milliseconds since the timer was started.
+     */
+    int time()
     {
-
+        return (int) msecs();
     }
 
     /**
@@ -219,6 +223,11 @@ private:
  * Use this by computing differences between two calls.
  * @author Dick Hollenbeck
  */
-unsigned GetRunningMicroSecs();
+inline unsigned GetRunningMicroSecs()
+{
+    using CLOCK = std::chrono::steady_clock;
+    using DUR_US = std::chrono::duration<unsigned long long, std::micro>;
+    return (unsigned) std::chrono::duration_cast<DUR_US>( CLOCK::now().time_since_epoch() ).count();
+}
 
 #endif  // TPROFILE_H
\ No newline at end of file
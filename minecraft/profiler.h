@@ -0,0 +1,371 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "profile.h"
+using namespace std;
+
+/*
+* Compiled out when PROFILER_DISABLE is defined
+*/
+#ifdef PROFILER_DISABLE
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE_CONCAT(a, b) a##b
+#define PROFILE_ZONE_NAME(line) PROFILE_ZONE_CONCAT(profile_zone_, line)
+/* Time the rest of the enclosing scope as a zone, name must be a string literal */
+#define PROFILE_ZONE(name) profiler::Zone PROFILE_ZONE_NAME(__LINE__)(name)
+#endif
+
+/**
+* Hierarchical frame profiler
+* Scoped zones are recorded into a lock-free ring buffer owned by the thread
+* that ran them, the main thread drains every buffer once per frame into an
+* aggregated breakdown, and optionally into a Chrome trace-event capture
+*/
+namespace profiler {
+
+	/* Completed zone, times in nanoseconds since the profiler epoch */
+	struct Record
+	{
+		const char* name;
+		uint64_t start, end;
+		uint32_t frame;
+		uint16_t depth;
+		uint16_t thread;
+	};
+
+	/* Records per thread buffer, a power of two */
+	const uint32_t buffer_size = 4096;
+	/* Threads that can record zones at once, the slot of an exited thread is reused */
+	const int max_threads = 64;
+	/* Distinct zone names per breakdown */
+	const int max_entries = 32;
+	/* Trace capture limit, in records */
+	const size_t max_trace = 1 << 22;
+
+	/* Nanoseconds since the first call, same clock as PROF_COUNTER */
+	inline uint64_t now() {
+		using CLOCK = std::chrono::high_resolution_clock;
+		static const CLOCK::time_point epoch = CLOCK::now();
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(CLOCK::now() - epoch).count();
+	}
+
+	/*
+	* Single producer, single consumer ring of records
+	* The owning thread pushes, the main thread drains, zones are dropped when full
+	*/
+	class Buffer
+	{
+	public:
+		uint16_t thread;
+		/* Nesting depth of the zones open on the owning thread */
+		uint16_t depth = 0;
+		atomic<uint32_t> head{ 0 }, tail{ 0 };
+		atomic<uint32_t> dropped{ 0 };
+		/* Set when the owning thread exits, the next thread to register takes the buffer over */
+		atomic<bool> released{ false };
+		Record records[buffer_size];
+
+		inline void push(const Record& r) {
+			uint32_t h = head.load(memory_order_relaxed);
+			if (h - tail.load(memory_order_acquire) >= buffer_size) {
+				dropped.fetch_add(1, memory_order_relaxed);
+				return;
+			}
+			records[h & (buffer_size - 1)] = r;
+			head.store(h + 1, memory_order_release);
+		}
+	};
+
+	/* Every registered buffer, buffers live until the process exits and are reused across threads */
+	inline atomic<Buffer*>* buffers() {
+		static atomic<Buffer*> list[max_threads];
+		return list;
+	}
+	inline atomic<int>& buffer_count() {
+		static atomic<int> count{ 0 };
+		return count;
+	}
+	/* Zones of threads that found no free slot, reported as dropped */
+	inline atomic<uint32_t>& unregistered() {
+		static atomic<uint32_t> count{ 0 };
+		return count;
+	}
+	/* Frame the zones are recorded in */
+	inline atomic<uint32_t>& current_frame() {
+		static atomic<uint32_t> frame{ 0 };
+		return frame;
+	}
+
+	/* Slot of a thread, released when the thread exits */
+	struct Registration
+	{
+		Buffer* buffer = nullptr;
+		bool registered = false;
+
+		~Registration() {
+			if (buffer)
+				buffer->released.store(true, memory_order_release);
+		}
+	};
+
+	/*
+	*  Buffer of the calling thread, registered on first use, reusing the
+	*  buffer of an exited thread if there is one, nullptr when out of slots
+	*  Records the exited thread left are still drained by frame_end
+	*/
+	inline Buffer* thread_buffer() {
+		thread_local Registration slot;
+		if (!slot.registered) {
+			slot.registered = true;
+			int count = buffer_count().load(memory_order_acquire);
+			for (int i = 0; i < count && slot.buffer == nullptr; i++) {
+				Buffer* b = buffers()[i].load(memory_order_acquire);
+				bool released = true;
+				if (b && b->released.compare_exchange_strong(released, false, memory_order_acquire))
+					slot.buffer = b;
+			}
+			if (slot.buffer)
+				return slot.buffer;
+			int index = buffer_count().load(memory_order_relaxed);
+			while (index < max_threads && !buffer_count().compare_exchange_weak(index, index + 1, memory_order_relaxed)) {}
+			if (index < max_threads) {
+				slot.buffer = new Buffer();
+				slot.buffer->thread = (uint16_t)index;
+				buffers()[index].store(slot.buffer, memory_order_release);
+			}
+		}
+		return slot.buffer;
+	}
+
+	/*
+	* Scoped zone, times its own lifetime
+	*/
+	class Zone
+	{
+	public:
+		Zone(const char* name) {
+			buffer = thread_buffer();
+			if (buffer == nullptr) {
+				unregistered().fetch_add(1, memory_order_relaxed);
+				return;
+			}
+			this->name = name;
+			depth = buffer->depth++;
+			start = now();
+		}
+
+		~Zone() {
+			if (buffer == nullptr)
+				return;
+			buffer->depth--;
+			buffer->push({ name, start, now(), current_frame().load(memory_order_relaxed), depth, buffer->thread });
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		Buffer* buffer;
+		const char* name = nullptr;
+		uint64_t start = 0;
+		uint16_t depth = 0;
+	};
+
+	/*
+	* Time spent per zone name, ordered by first start
+	* Holds a single frame, or the sum of several with accumulate
+	*/
+	struct Breakdown
+	{
+		struct Entry
+		{
+			const char* name;
+			/* Deepest nesting the zone was seen at */
+			uint16_t depth;
+			uint32_t calls;
+			uint64_t start;
+			double msecs;
+		};
+
+		int count = 0;
+		uint32_t frames = 0;
+		/* Zones lost to full buffers, or to threads past max_threads */
+		uint32_t dropped = 0;
+		Entry entries[max_entries];
+
+		inline void clear() {
+			count = 0;
+			frames = 0;
+			dropped = 0;
+		}
+
+		/* Entry of a zone name, created if missing, nullptr when the table is full */
+		inline Entry* find(const char* name, uint16_t depth, uint64_t start) {
+			for (int i = 0; i < count; i++)
+				if (entries[i].name == name || strcmp(entries[i].name, name) == 0)
+					return &entries[i];
+			if (count == max_entries)
+				return nullptr;
+			entries[count] = { name, depth, 0, start, 0.0 };
+			return &entries[count++];
+		}
+
+		inline void add(const Record& r) {
+			Entry* e = find(r.name, r.depth, r.start);
+			if (e == nullptr)
+				return;
+			if (r.depth > e->depth)
+				e->depth = r.depth;
+			if (r.start < e->start)
+				e->start = r.start;
+			e->calls++;
+			e->msecs += (r.end - r.start) / 1e6;
+		}
+
+		/* Add the times of another breakdown */
+		inline void accumulate(const Breakdown& other) {
+			for (int i = 0; i < other.count; i++) {
+				const Entry& o = other.entries[i];
+				Entry* e = find(o.name, o.depth, o.start);
+				if (e == nullptr)
+					continue;
+				e->calls += o.calls;
+				e->msecs += o.msecs;
+			}
+			frames += other.frames;
+			dropped += other.dropped;
+		}
+
+		/* Milliseconds per frame of a zone, 0 if it never ran */
+		inline double average(const char* name) const {
+			for (int i = 0; i < count; i++)
+				if (strcmp(entries[i].name, name) == 0)
+					return entries[i].msecs / (frames ? frames : 1);
+			return 0.0;
+		}
+
+		/* Sort parents before their children, by first start */
+		inline void sort() {
+			for (int i = 1; i < count; i++)
+				for (int j = i; j > 0 && entries[j].start < entries[j - 1].start; j--)
+					swap(entries[j], entries[j - 1]);
+		}
+
+		/* "name ms name ms ...", per frame, for zones nested at most max_depth deep */
+		inline int format(char* out, size_t size, int min_depth = 0, int max_depth = 0xffff) const {
+			int length = 0;
+			out[0] = '\0';
+			for (int i = 0; i < count && (size_t)length < size; i++) {
+				if (entries[i].depth < min_depth || entries[i].depth > max_depth)
+					continue;
+				length += snprintf(out + length, size - length, "%s%s %.2f", length ? " " : "", entries[i].name,
+					entries[i].msecs / (frames ? frames : 1));
+			}
+			return length;
+		}
+
+		/* Indented table of every zone, per frame */
+		inline void print(FILE* file) const {
+			for (int i = 0; i < count; i++)
+				fprintf(file, "%*s%-*s %8.3f ms %6.1f calls\n", 2 * entries[i].depth, "", 24 - 2 * entries[i].depth,
+					entries[i].name, entries[i].msecs / (frames ? frames : 1), (double)entries[i].calls / (frames ? frames : 1));
+		}
+	};
+
+	/* Records kept for export, only filled while tracing */
+	inline vector<Record>& trace() {
+		static vector<Record> records;
+		return records;
+	}
+	inline bool& tracing() {
+		static bool enabled = false;
+		return enabled;
+	}
+
+	/* Value of a named counter at a time, in nanoseconds since the profiler epoch */
+	struct Sample
+	{
+		const char* name;
+		uint64_t time;
+		double value;
+	};
+
+	/* Counter values kept for export, only filled while tracing */
+	inline vector<Sample>& samples() {
+		static vector<Sample> values;
+		return values;
+	}
+
+	/* Record the value of a counter, a track of its own in the trace, call from the main thread */
+	inline void counter(const char* name, double value) {
+		if (tracing() && samples().size() < max_trace)
+			samples().push_back({ name, now(), value });
+	}
+
+	/* Keep every record from now on, for write_trace */
+	inline void trace_begin(size_t reserve = 1 << 16) {
+		trace().reserve(reserve);
+		tracing() = true;
+	}
+
+	/*
+	*  Drain every thread buffer into the breakdown of the frame that ended,
+	*  and start the next frame. Call from the main thread, between frames
+	*/
+	inline void frame_end(Breakdown& breakdown) {
+		breakdown.clear();
+		breakdown.frames = 1;
+		int threads = buffer_count().load(memory_order_acquire);
+		for (int t = 0; t < threads; t++) {
+			/* nullptr while the slot is being registered */
+			Buffer* b = buffers()[t].load(memory_order_acquire);
+			if (b == nullptr)
+				continue;
+			uint32_t tail = b->tail.load(memory_order_relaxed), head = b->head.load(memory_order_acquire);
+			for (; tail != head; tail++) {
+				const Record& r = b->records[tail & (buffer_size - 1)];
+				breakdown.add(r);
+				if (tracing() && trace().size() < max_trace)
+					trace().push_back(r);
+			}
+			b->tail.store(tail, memory_order_release);
+			breakdown.dropped += b->dropped.exchange(0, memory_order_relaxed);
+		}
+		breakdown.dropped += unregistered().exchange(0, memory_order_relaxed);
+		breakdown.sort();
+		current_frame().fetch_add(1, memory_order_relaxed);
+	}
+
+	/*
+	*  Write the traced records as Chrome trace-event JSON,
+	*  viewable in chrome://tracing or Perfetto. Returns false if the file can't be written
+	*/
+	inline bool write_trace(const char* path) {
+		FILE* file = fopen(path, "w");
+		if (file == nullptr)
+			return false;
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		/* Thread names, the first thread to record a zone is the main thread */
+		int threads = buffer_count().load(memory_order_acquire);
+		for (int t = 0; t < threads; t++)
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}\n",
+				t ? "," : "", t, t == 0 ? "main" : "thread", t);
+		/* Complete events, times in microseconds */
+		for (const Record& r : trace())
+			fprintf(file, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}\n",
+				r.name, r.thread, r.start / 1e3, (r.end - r.start) / 1e3, r.frame);
+		/* Counter events */
+		for (const Sample& s : samples())
+			fprintf(file, ",{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"value\":%g}}\n",
+				s.name, s.time / 1e3, s.value);
+		fprintf(file, "]}\n");
+		fclose(file);
+		return true;
+	}
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <new>
+#include "arena.h"
+
+/**
+* Filled triangle rasterization with a depth buffer
+*/
+namespace raster {
+
+	/* Vertices are snapped to 1/16 of a cell, so the edge functions are exact integers */
+	const int subcell_bits = 4;
+	const int64_t subcell = 1 << subcell_bits;
+
+	/* Twice the signed area of (a, b, p), > 0 when p is left of a -> b */
+	inline int64_t edge(const int64_t a[2], const int64_t b[2], int64_t px, int64_t py) {
+		return (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+	}
+
+	/*
+	*  Top-left fill rule, for clockwise triangles on screen (y down): a cell
+	*  centre exactly on an edge belongs to the triangle only when the edge
+	*  is a top or a left edge, so triangles sharing an edge cover it once
+	*/
+	inline bool top_left(const int64_t a[2], const int64_t b[2]) {
+		return (a[1] == b[1] && b[0] > a[0]) || b[1] < a[1];
+	}
+
+	/*
+	*  Half-space rasterizer, fills the cells of the (x0, y0) - (x1, y1) rectangle
+	*  (exclusive) whose centre (x + 0.5, y + 0.5) is covered by the triangle,
+	*  vertices are (x, y, 1/w)
+	*  Depth is the interpolated 1/w, a cell is written when it is nearer (larger)
+	*/
+	inline void triangle(const float v0[3], const float v1[3], const float v2[3], wchar_t c,
+		wchar_t* buffer, float* depth, int stride, int x0, int y0, int x1, int y1) {
+		int64_t p[3][2];
+		const float* v[3] = { v0, v1, v2 };
+		for (int i = 0; i < 3; i++) {
+			p[i][0] = (int64_t)lrintf(v[i][0] * subcell);
+			p[i][1] = (int64_t)lrintf(v[i][1] * subcell);
+		}
+		int64_t area = edge(p[0], p[1], p[2][0], p[2][1]);
+		if (area == 0)
+			return;
+		/* Counter clockwise triangles are flipped */
+		int i1 = 1, i2 = 2;
+		if (area < 0) {
+			i1 = 2;
+			i2 = 1;
+			area = -area;
+		}
+		const int64_t* p0 = p[0];
+		const int64_t* p1 = p[i1];
+		const int64_t* p2 = p[i2];
+
+		/* Bounding box of the cell centres inside the triangle, clamped to the rectangle */
+		const int64_t half = subcell / 2;
+		int64_t lo_x = p0[0] < p1[0] ? (p0[0] < p2[0] ? p0[0] : p2[0]) : (p1[0] < p2[0] ? p1[0] : p2[0]);
+		int64_t lo_y = p0[1] < p1[1] ? (p0[1] < p2[1] ? p0[1] : p2[1]) : (p1[1] < p2[1] ? p1[1] : p2[1]);
+		int64_t hi_x = p0[0] > p1[0] ? (p0[0] > p2[0] ? p0[0] : p2[0]) : (p1[0] > p2[0] ? p1[0] : p2[0]);
+		int64_t hi_y = p0[1] > p1[1] ? (p0[1] > p2[1] ? p0[1] : p2[1]) : (p1[1] > p2[1] ? p1[1] : p2[1]);
+		int min_x = (int)((lo_x - half + subcell - 1) >> subcell_bits);
+		int min_y = (int)((lo_y - half + subcell - 1) >> subcell_bits);
+		int max_x = (int)((hi_x - half) >> subcell_bits);
+		int max_y = (int)((hi_y - half) >> subcell_bits);
+		min_x = min_x < x0 ? x0 : min_x;
+		min_y = min_y < y0 ? y0 : min_y;
+		max_x = max_x > x1 - 1 ? x1 - 1 : max_x;
+		max_y = max_y > y1 - 1 ? y1 - 1 : max_y;
+		if (min_x > max_x || min_y > max_y)
+			return;
+
+		/* Edge function steps along x and y, one cell apart */
+		const int64_t a0 = (p1[1] - p2[1]) * subcell, b0 = (p2[0] - p1[0]) * subcell;
+		const int64_t a1 = (p2[1] - p0[1]) * subcell, b1 = (p0[0] - p2[0]) * subcell;
+		const int64_t a2 = (p0[1] - p1[1]) * subcell, b2 = (p1[0] - p0[0]) * subcell;
+		/* Depth, as a plane over the edge functions */
+		const float inv_area = 1.0f / (float)area;
+		const float* d1 = i1 == 1 ? v1 : v2;
+		const float* d2 = i2 == 1 ? v1 : v2;
+		const float z1 = (d1[2] - v0[2]) * inv_area, z2 = (d2[2] - v0[2]) * inv_area;
+
+		/* Edges which are not top-left need a strictly positive value */
+		const int64_t px = ((int64_t)min_x << subcell_bits) + half, py = ((int64_t)min_y << subcell_bits) + half;
+		int64_t w0_row = edge(p1, p2, px, py) - (top_left(p1, p2) ? 0 : 1);
+		int64_t w1_row = edge(p2, p0, px, py) - (top_left(p2, p0) ? 0 : 1);
+		int64_t w2_row = edge(p0, p1, px, py) - (top_left(p0, p1) ? 0 : 1);
+		for (int y = min_y; y <= max_y; y++) {
+			int64_t w0 = w0_row, w1 = w1_row, w2 = w2_row;
+			wchar_t* row = buffer + y * stride;
+			float* depth_row = depth + y * stride;
+			for (int x = min_x; x <= max_x; x++) {
+				if ((w0 | w1 | w2) >= 0) {
+					float z = v0[2] + (float)w1 * z1 + (float)w2 * z2;
+					if (z > depth_row[x]) {
+						depth_row[x] = z;
+						row[x] = c;
+					}
+				}
+				w0 += a0;
+				w1 += a1;
+				w2 += a2;
+			}
+			w0_row += b0;
+			w1_row += b1;
+			w2_row += b2;
+		}
+	}
+
+	/* Tile dimensions, in cells */
+	const int tile_width = 32;
+	const int tile_height = 16;
+
+	/*
+	* Triangles binned per screen tile. A tile only writes its own cells
+	* and rasterizes its triangles in submission order, so tiles can be
+	* rendered in parallel and the output does not depend on the thread count
+	*/
+	class Tiles
+	{
+	public:
+		int columns = 0, rows = 0, width = 0, height = 0;
+		/* Indexes of the triangles overlapping each tile, in the frame arena */
+		ArenaArray<uint32_t>* bins = nullptr;
+
+		inline void resize(int width, int height) {
+			this->width = width;
+			this->height = height;
+			columns = (width + tile_width - 1) / tile_width;
+			rows = (height + tile_height - 1) / tile_height;
+			bins = nullptr;
+		}
+
+		inline int count() const { return columns * rows; }
+
+		/* Start a frame with empty bins, allocated from the frame arena */
+		inline void clear(Arena& arena) {
+			bins = arena.alloc_array<ArenaArray<uint32_t>>(count());
+			for (int i = 0; i < count(); i++)
+				new (&bins[i]) ArenaArray<uint32_t>(arena);
+		}
+
+		/* Cells (x0, y0) - (x1, y1), exclusive, of a tile */
+		inline void rect(int tile, int& x0, int& y0, int& x1, int& y1) const {
+			x0 = (tile % columns) * tile_width;
+			y0 = (tile / columns) * tile_height;
+			x1 = x0 + tile_width < width ? x0 + tile_width : width;
+			y1 = y0 + tile_height < height ? y0 + tile_height : height;
+		}
+
+		/* Add a triangle to every tile its bounding box overlaps */
+		inline void add(uint32_t index, const float v0[3], const float v1[3], const float v2[3]) {
+			int min_x = (int)floorf(fminf(v0[0], fminf(v1[0], v2[0]))) / tile_width;
+			int min_y = (int)floorf(fminf(v0[1], fminf(v1[1], v2[1]))) / tile_height;
+			int max_x = (int)ceilf(fmaxf(v0[0], fmaxf(v1[0], v2[0]))) / tile_width;
+			int max_y = (int)ceilf(fmaxf(v0[1], fmaxf(v1[1], v2[1]))) / tile_height;
+			min_x = min_x < 0 ? 0 : min_x;
+			min_y = min_y < 0 ? 0 : min_y;
+			max_x = max_x >= columns ? columns - 1 : max_x;
+			max_y = max_y >= rows ? rows - 1 : max_y;
+			for (int y = min_y; y <= max_y; y++)
+				for (int x = min_x; x <= max_x; x++)
+					bins[y * columns + x].push_back(index);
+		}
+	};
+}
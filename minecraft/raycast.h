@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "world.h"
+#include "threads.h"
+
+/**
+* Ray queries against the chunk store, block picking and line of sight
+* Rays walk the block grid one cell at a time (Amanatides & Woo), reading
+* the blocks in place, so a query never allocates
+*/
+namespace raycast {
+
+	/* Rays of a batch handed to each thread at a time */
+	const int batch_group = 256;
+
+	struct Ray
+	{
+		float origin[3];
+		/* Direction, any non zero length */
+		float dir[3];
+		float max_distance;
+	};
+
+	/*
+	* First solid block along a ray, block is AIR if there is none within
+	* the max distance, then distance is the max distance
+	* face is the face the ray entered through, as a mesh face direction
+	* (see mesh::face_offsets), -1 when the ray starts inside the block
+	*/
+	struct Hit
+	{
+		int x, y, z;
+		float distance;
+		uint8_t block;
+		int8_t face;
+	};
+
+	/*
+	*  Cast a ray from origin along dir, blocks are centered on integer
+	*  coordinates like the meshes, unloaded chunks are empty
+	*  Stops at the first solid block, past max_distance, or once the ray
+	*  leaves the world vertically. Returns true on a hit
+	*/
+	inline bool cast(const world::World& w, const float origin[3], const float dir[3], float max_distance, Hit& hit) {
+		hit.block = world::AIR;
+		hit.face = -1;
+		hit.distance = max_distance;
+		float length = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		if (length == 0.0f)
+			return false;
+
+		/* Faces entered when stepping + and - along each axis */
+		const int8_t enter_faces[3][2] = { { 4, 2 }, { 0, 1 }, { 5, 3 } };
+		int cell[3], step[3];
+		float t_max[3], t_delta[3];
+		int8_t faces[3];
+		for (int a = 0; a < 3; a++) {
+			float p = origin[a] + 0.5f, d = dir[a] / length;
+			cell[a] = (int)floorf(p);
+			if (d > 0.0f) {
+				step[a] = 1;
+				t_delta[a] = 1.0f / d;
+				t_max[a] = (cell[a] + 1 - p) * t_delta[a];
+			}
+			else if (d < 0.0f) {
+				step[a] = -1;
+				t_delta[a] = -1.0f / d;
+				t_max[a] = (p - cell[a]) * t_delta[a];
+			}
+			else {
+				step[a] = 0;
+				t_delta[a] = INFINITY;
+				t_max[a] = INFINITY;
+			}
+			faces[a] = enter_faces[a][step[a] < 0];
+		}
+
+		/* Chunk of the current cell, looked up again only when the ray crosses into another */
+		int ccx = world::chunk_coord(cell[0]), ccz = world::chunk_coord(cell[2]);
+		int lx = world::local_coord(cell[0]), lz = world::local_coord(cell[2]);
+		const world::Chunk* c = w.chunk(ccx, ccz);
+		float t = 0.0f;
+		int8_t face = -1;
+		while (t <= max_distance) {
+			if (cell[1] >= 0 && cell[1] < world::chunk_height) {
+				uint8_t block = c ? c->get(lx, cell[1], lz) : world::AIR;
+				if (block != world::AIR) {
+					hit.x = cell[0];
+					hit.y = cell[1];
+					hit.z = cell[2];
+					hit.distance = t;
+					hit.block = block;
+					hit.face = face;
+					return true;
+				}
+			}
+			else if ((cell[1] < 0) == (step[1] <= 0))
+				return false;
+
+			/* Step into the nearest cell boundary */
+			int a = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+			t = t_max[a];
+			t_max[a] += t_delta[a];
+			cell[a] += step[a];
+			face = faces[a];
+			if (a == 0) {
+				lx += step[0];
+				if (lx != (lx & world::chunk_mask)) {
+					lx &= world::chunk_mask;
+					ccx += step[0];
+					c = w.chunk(ccx, ccz);
+				}
+			}
+			else if (a == 2) {
+				lz += step[2];
+				if (lz != (lz & world::chunk_mask)) {
+					lz &= world::chunk_mask;
+					ccz += step[2];
+					c = w.chunk(ccx, ccz);
+				}
+			}
+		}
+		return false;
+	}
+
+	/*
+	*  Direction the camera looks at, rotated by camera_rot (degrees) like
+	*  the renderer view: (0, 0, 1) times rotation_x, then rotation_y
+	*/
+	inline void camera_direction(const float camera_rot[4], float out[3]) {
+		const float radians = 3.14159265358979323846f / 180.0f;
+		float sx = sinf(camera_rot[0] * radians), cx = cosf(camera_rot[0] * radians);
+		float sy = sinf(camera_rot[1] * radians), cy = cosf(camera_rot[1] * radians);
+		out[0] = -sy * cx;
+		out[1] = -sx;
+		out[2] = cy * cx;
+	}
+
+	/* Block the camera looks at, within reach blocks */
+	inline bool pick(const world::World& w, const float camera_pos[4], const float camera_rot[4], float reach, Hit& hit) {
+		float dir[3];
+		camera_direction(camera_rot, dir);
+		return cast(w, camera_pos, dir, reach, hit);
+	}
+
+	/*
+	*  Cast n rays over the threads of a pool, hits[i] is the result of rays[i]
+	*  The world must not change while the batch runs
+	*/
+	inline void cast_batch(ThreadPool& pool, const world::World& w, const Ray* rays, Hit* hits, int n) {
+		pool.run((n + batch_group - 1) / batch_group, [&](int group) {
+			int end = (group + 1) * batch_group < n ? (group + 1) * batch_group : n;
+			for (int i = group * batch_group; i < end; i++)
+				cast(w, rays[i].origin, rays[i].dir, rays[i].max_distance, hits[i]);
+		});
+	}
+}
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "world.h"
+using namespace std;
+
+/**
+* On-disk world, chunks are stored in region files of 32x32 chunks,
+* each chunk compressed on its own and read through a memory mapping
+*
+* Region file layout, little endian:
+*   "MCRG", uint32 version
+*   Entry[1024], offset, size and capacity of each chunk, 0 if absent,
+*   indexed (cz & 31) * 32 + (cx & 31)
+*   chunk payloads, run length encoded (count, block) byte pairs
+* A chunk is rewritten in place when it fits its capacity, appended otherwise
+*/
+namespace region {
+
+	const int region_shift = 5;
+	const int region_size = 1 << region_shift;
+	const int region_chunks = region_size * region_size;
+	/* Version 2 chunks are 32 blocks high, older regions are not read */
+	const uint32_t version = 2;
+	/* Largest compressed chunk, every block in a run of 1 */
+	const int max_payload = 2 * world::chunk_volume;
+
+	struct Entry
+	{
+		uint32_t offset, size, capacity;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		Entry entries[region_chunks];
+	};
+
+	/*
+	* World settings, stored in level.txt next to the regions:
+	*   seed <seed>
+	*   terrain noise | terrain grid <map size>
+	*/
+	struct Level
+	{
+		enum Terrain { NOISE, GRID };
+
+		uint32_t seed = 0;
+		/* Generator of the chunks that are not on disk, and the map size of GRID */
+		Terrain terrain = NOISE;
+		int map_size = 0;
+	};
+
+	/* Index of a chunk in its region */
+	inline int chunk_index(int cx, int cz) { return (cz & (region_size - 1)) * region_size + (cx & (region_size - 1)); }
+
+	/* Run length encode chunk blocks, out holds max_payload bytes, returns the size */
+	inline size_t compress(const uint8_t* blocks, uint8_t* out) {
+		size_t size = 0;
+		for (int i = 0; i < world::chunk_volume;) {
+			uint8_t block = blocks[i];
+			int run = 1;
+			while (i + run < world::chunk_volume && run < 255 && blocks[i + run] == block)
+				run++;
+			out[size++] = (uint8_t)run;
+			out[size++] = block;
+			i += run;
+		}
+		return size;
+	}
+
+	/* Decode a payload into chunk blocks, false if it is corrupt */
+	inline bool decompress(const uint8_t* in, size_t size, uint8_t* blocks) {
+		int n = 0;
+		for (size_t i = 0; i + 1 < size; i += 2) {
+			int run = in[i];
+			if (run == 0 || n + run > world::chunk_volume)
+				return false;
+			memset(blocks + n, in[i + 1], run);
+			n += run;
+		}
+		return n == world::chunk_volume;
+	}
+
+	/*
+	* Read only memory mapping of a whole file
+	*/
+	class MappedFile
+	{
+	public:
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+
+		~MappedFile() { close(); }
+
+		/* Map a file, false if it does not exist or is empty */
+		bool open(const char* path) {
+			close();
+#ifdef _WIN32
+			file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER length;
+			if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL) {
+				close();
+				return false;
+			}
+			data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = (size_t)length.QuadPart;
+#else
+			int fd = ::open(path, O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size == 0) {
+				::close(fd);
+				return false;
+			}
+			void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			/* The mapping keeps the file referenced */
+			::close(fd);
+			data = p == MAP_FAILED ? nullptr : (const uint8_t*)p;
+			size = (size_t)st.st_size;
+#endif
+			if (data == nullptr) {
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (data != nullptr)
+				UnmapViewOfFile(data);
+			if (mapping != NULL)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (data != nullptr)
+				munmap((void*)data, size);
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#endif
+	};
+
+	/*
+	* Directory of region files, also a world generator: chunks found on
+	* disk are loaded, the others come from the fallback generator
+	* Opening only records the directory, a region file is mapped the first
+	* time one of its chunks is read, and only the pages touched are read in
+	*/
+	class Store : public world::Generator
+	{
+	public:
+		/* Chunks loaded from disk, and written to it */
+		mutable uint32_t loaded = 0;
+		uint32_t saved = 0;
+
+		Store(const char* directory, const world::Generator* fallback = nullptr) {
+			this->directory = directory;
+			this->fallback = fallback;
+#ifdef _WIN32
+			_mkdir(directory);
+#else
+			mkdir(directory, 0755);
+#endif
+		}
+
+		/* Generator of the chunks that are not on disk */
+		inline void set_fallback(const world::Generator* fallback) { this->fallback = fallback; }
+
+		~Store() {
+			for (auto& it : regions)
+				delete it.second;
+		}
+
+		Store(const Store&) = delete;
+		Store& operator=(const Store&) = delete;
+
+		/* Read a chunk at its cx, cz, false if it is not on disk */
+		bool load(world::Chunk& chunk) const {
+			lock_guard<mutex> lock(m);
+			const MappedFile* file = map(chunk.cx, chunk.cz);
+			if (file == nullptr)
+				return false;
+			const Header* header = (const Header*)file->data;
+			const Entry& e = header->entries[chunk_index(chunk.cx, chunk.cz)];
+			if (e.size == 0 || (size_t)e.offset + e.size > file->size)
+				return false;
+			uint8_t blocks[world::chunk_volume];
+			if (!decompress(file->data + e.offset, e.size, blocks))
+				return false;
+			chunk.write(blocks);
+			loaded++;
+			return true;
+		}
+
+		void generate(world::Chunk& chunk) const override {
+			if (!load(chunk) && fallback != nullptr)
+				fallback->generate(chunk);
+		}
+
+		/* Write a chunk to its region file, false on I/O errors */
+		bool save(world::Chunk& chunk) {
+			world::Chunk* list[1] = { &chunk };
+			return save_region(list, 1) == 1;
+		}
+
+		/*
+		*  Write every dirty chunk of a world, returns the number written
+		*  Chunks are grouped by region, each region file is opened and its
+		*  header written once
+		*/
+		int save(world::World& w) {
+			vector<world::Chunk*> dirty;
+			for (auto& it : w.chunks)
+				if (it.second->dirty())
+					dirty.push_back(it.second);
+			auto region_key = [](const world::Chunk* c) { return world::chunk_key(c->cx >> region_shift, c->cz >> region_shift); };
+			sort(dirty.begin(), dirty.end(), [&](const world::Chunk* a, const world::Chunk* b) { return region_key(a) < region_key(b); });
+			int count = 0;
+			for (size_t i = 0; i < dirty.size();) {
+				size_t end = i + 1;
+				while (end < dirty.size() && region_key(dirty[end]) == region_key(dirty[i]))
+					end++;
+				count += save_region(dirty.data() + i, end - i);
+				i = end;
+			}
+			return count;
+		}
+
+		/*
+		*  Settings of the world, false if there is no seed
+		*  Fields missing from the file, like the terrain of worlds saved
+		*  before it was stored, keep their value
+		*/
+		bool read_level(Level& level) const {
+			FILE* file = fopen((directory + "/level.txt").c_str(), "r");
+			if (file == nullptr)
+				return false;
+			bool ok = fscanf(file, " seed %u", &level.seed) == 1;
+			char terrain[16];
+			if (ok && fscanf(file, " terrain %15s", terrain) == 1) {
+				if (strcmp(terrain, "grid") == 0 && fscanf(file, "%d", &level.map_size) == 1 && level.map_size >= 10)
+					level.terrain = Level::GRID;
+				else if (strcmp(terrain, "noise") == 0)
+					level.terrain = Level::NOISE;
+			}
+			fclose(file);
+			return ok;
+		}
+
+		bool write_level(const Level& level) const {
+			FILE* file = fopen((directory + "/level.txt").c_str(), "w");
+			if (file == nullptr)
+				return false;
+			fprintf(file, "seed %u\n", level.seed);
+			if (level.terrain == Level::GRID)
+				fprintf(file, "terrain grid %d\n", level.map_size);
+			else
+				fprintf(file, "terrain noise\n");
+			return fclose(file) == 0;
+		}
+
+	private:
+		string directory;
+		const world::Generator* fallback;
+		/* Mapped regions by region coordinates, guarded by m */
+		mutable mutex m;
+		mutable unordered_map<uint64_t, MappedFile*> regions;
+
+		/*
+		*  Write chunks of a single region, the header is written after every
+		*  payload, returns the number written, 0 on I/O errors
+		*/
+		size_t save_region(world::Chunk* const* chunks, size_t count) {
+			lock_guard<mutex> lock(m);
+			int rx = chunks[0]->cx >> region_shift, rz = chunks[0]->cz >> region_shift;
+			string path = region_path(rx, rz);
+			/* Drop the mapping before writing, it is remapped by the next load */
+			auto it = regions.find(world::chunk_key(rx, rz));
+			if (it != regions.end())
+				it->second->close();
+
+			FILE* file = fopen(path.c_str(), "r+b");
+			Header* header = new Header();
+			bool ok = true;
+			if (file == nullptr || fread(header, sizeof(Header), 1, file) != 1 ||
+				memcmp(header->magic, "MCRG", 4) != 0 || header->version != version) {
+				/* New, or unreadable region, start it over */
+				if (file != nullptr)
+					fclose(file);
+				file = fopen(path.c_str(), "w+b");
+				memset(header, 0, sizeof(Header));
+				memcpy(header->magic, "MCRG", 4);
+				header->version = version;
+				ok = file != nullptr && fwrite(header, sizeof(Header), 1, file) == 1;
+			}
+			uint8_t blocks[world::chunk_volume], payload[max_payload];
+			for (size_t i = 0; ok && i < count; i++) {
+				chunks[i]->read(blocks);
+				uint32_t size = (uint32_t)compress(blocks, payload);
+				Entry& e = header->entries[chunk_index(chunks[i]->cx, chunks[i]->cz)];
+				if (e.offset == 0 || size > e.capacity) {
+					fseek(file, 0, SEEK_END);
+					e.offset = (uint32_t)ftell(file);
+					e.capacity = size;
+				}
+				e.size = size;
+				ok = fseek(file, e.offset, SEEK_SET) == 0 && fwrite(payload, 1, size, file) == size;
+			}
+			if (ok)
+				ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(header, sizeof(Header), 1, file) == 1;
+			if (file != nullptr && fclose(file) != 0)
+				ok = false;
+			delete header;
+			if (!ok)
+				return 0;
+			for (size_t i = 0; i < count; i++)
+				chunks[i]->saved_revision = chunks[i]->revision;
+			saved += (uint32_t)count;
+			return count;
+		}
+
+		inline string region_path(int rx, int rz) const {
+			char name[64];
+			snprintf(name, sizeof(name), "/r.%d.%d.mcr", rx, rz);
+			return directory + name;
+		}
+
+		/* Mapping of the region of a chunk, nullptr if it has no valid region file */
+		const MappedFile* map(int cx, int cz) const {
+			int rx = cx >> region_shift, rz = cz >> region_shift;
+			MappedFile*& file = regions[world::chunk_key(rx, rz)];
+			if (file == nullptr)
+				file = new MappedFile();
+			if (file->data == nullptr && !file->open(region_path(rx, rz).c_str()))
+				return nullptr;
+			const Header* header = (const Header*)file->data;
+			if (file->size < sizeof(Header) || memcmp(header->magic, "MCRG", 4) != 0 || header->version != version)
+				return nullptr;
+			return file;
+		}
+	};
+}
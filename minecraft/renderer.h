@@ -0,0 +1,469 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "vec.h"
+#include "mat.h"
+#include "world.h"
+#include "mesh.h"
+#include "raycast.h"
+#include "frustum.h"
+#include "clip.h"
+#include "raster.h"
+#include "threads.h"
+#include "transform.h"
+#include "arena.h"
+#include "profiler.h"
+using namespace std;
+
+/* Rendering settings, render_distance is the default of Renderer::distance */
+const float render_distance = 20;
+/* Default of Renderer::lod_distance, past it chunks are drawn as heightfields */
+const float lod_start_distance = 24;
+const float zNear = 0.1f;
+const float zFar = 1000.0f;
+const float fov = 70.0f;
+/* Luminance ramp, darkest to brightest, faces use every level but the blank */
+const char shade_ramp[] = " .:-=+*#%@";
+const int shade_levels = sizeof(shade_ramp) - 1;
+/* Direction the light travels in, and the light faces get when turned away from it */
+const float light_direction[3] = { 0.4f, -1.0f, 0.6f };
+const float ambient_light = 0.2f;
+/* Alignment of the framebuffer rows, a cache line */
+const int row_alignment = 64;
+
+/*
+* Draws the chunks around the camera into a char buffer, either
+* by rasterizing the triangles of their meshes, or by casting a ray
+* through the blocks for every cell
+*/
+class Renderer
+{
+public:
+	enum Mode { TRIANGLES, RAYCAST };
+
+	int width, height;
+	/*
+	*  Cells from the start of a row to the next, in both buffers, a multiple
+	*  of row_alignment bytes so every row starts on a cache line
+	*/
+	int stride = 0;
+	/* Char buffer, for rendering, height rows of stride cells */
+	wchar_t* buffer = nullptr;
+	/* Depth buffer, inverted w of the nearest triangle of each cell */
+	float* depth_buffer = nullptr;
+	/* Draw triangle edges instead of filling them */
+	bool wireframe = false;
+	/* Render path, can be switched between frames */
+	Mode mode = TRIANGLES;
+	/* Blocks drawn within distance of the camera on the x and z axes */
+	float distance = render_distance;
+	/*
+	*  Chunks farther than lod_distance on the x or z axis are drawn as coarser
+	*  heightfields, see mesh::lod_level, 0 draws every chunk at full detail
+	*/
+	float lod_distance = lod_start_distance;
+	/* Per-frame allocations, for every transient render list */
+	Arena arena;
+
+	/* Fill char of each face direction, from the light, see set_light */
+	wchar_t face_shades[6];
+
+	/* Statistics of the last frame, faces in range before and after greedy merging */
+	uint32_t unit_faces = 0, merged_faces = 0, triangles = 0;
+
+	/*
+	*  threads is the number of rasterizer threads, 0 uses every hardware thread
+	*  greedy merges coplanar block faces into larger quads
+	*  background builds the chunk meshes on a separate thread, edited chunks
+	*  keep their previous mesh until the new one is ready
+	*/
+	Renderer(world::World& chunks, int width, int height, int threads = 0, bool greedy = true, bool background = false)
+		: chunks(chunks), meshes(greedy), pool(threads) {
+		meshes.set_background(background);
+		resize(width, height);
+		set_light(light_direction, ambient_light);
+	}
+
+	~Renderer() { free(memory); }
+
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+
+	/*
+	*  Change the framebuffer size between frames, the buffers are
+	*  reallocated and the projection follows the new aspect ratio
+	*/
+	void resize(int width, int height) {
+		this->width = width < 1 ? 1 : width;
+		this->height = height < 1 ? 1 : height;
+		/* Both buffers start on a cache line, and so does every row */
+		const int cells = row_alignment / (int)min(sizeof(wchar_t), sizeof(float));
+		stride = (this->width + cells - 1) / cells * cells;
+		size_t count = (size_t)stride * this->height;
+		free(memory);
+		memory = (char*)malloc(count * (sizeof(wchar_t) + sizeof(float)) + row_alignment);
+		uintptr_t p = ((uintptr_t)memory + row_alignment - 1) & ~(uintptr_t)(row_alignment - 1);
+		buffer = (wchar_t*)p;
+		depth_buffer = (float*)(buffer + count);
+		tiles.resize(this->width, this->height);
+
+		/* Creation Projection Matrix */
+		mat4x4::projection_matrix(fov, (float)(this->height) / (float)(this->width), zNear, zFar, projection);
+		clear();
+	}
+
+	/*
+	*  Shade each face direction by the cosine between its normal and the
+	*  light, ambient is the light of the faces turned away from it
+	*  Faces are flat, so the shade of every face is a lookup by direction
+	*/
+	void set_light(const float direction[3], float ambient) {
+		float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+		for (int dir = 0; dir < 6; dir++) {
+			const float* n = mesh::normals[dir];
+			float d = length > 0.0f ? -(n[0] * direction[0] + n[1] * direction[1] + n[2] * direction[2]) / length : 1.0f;
+			float intensity = ambient + (1.0f - ambient) * fmaxf(d, 0.0f);
+			int level = 1 + (int)(intensity * (shade_levels - 2) + 0.5f);
+			face_shades[dir] = shade_ramp[min(max(level, 1), shade_levels - 1)];
+		}
+	}
+
+	/* Rasterizer threads, including the calling thread */
+	inline int threads() const { return pool.size(); }
+
+	/* Wait for the chunk meshes requested by the frames so far, the next frame draws them */
+	inline void flush() { meshes.flush(); }
+
+	/* Chunk meshes built since creation */
+	inline uint32_t rebuilds() const { return meshes.rebuilds; }
+
+	/* Bytes used by the cached chunk meshes */
+	inline size_t mesh_memory() const { return meshes.memory(); }
+
+	/* Drop the cached mesh of a chunk, when it leaves the world */
+	inline void forget(int cx, int cz) { meshes.erase(cx, cz); }
+
+	/* Clear buffer with blank chars, and depth buffer, 0 is infinitely far */
+	inline void clear() {
+		for (int i = 0; i < stride * height; ++i) {
+			buffer[i] = 0x20;
+			depth_buffer[i] = 0.0f;
+		}
+	}
+
+	/* Render a frame seen from camera_pos, rotated by camera_rot (degrees) */
+	void render(const float camera_pos[4], const float camera_rot[4]) {
+		PROFILE_ZONE("render");
+		{
+			PROFILE_ZONE("clear");
+			clear();
+			arena.reset();
+		}
+
+		/* Calculate Camera rotation matrices */
+		float camera_rotation[16], camera_rx[16], camera_ry[16], camera_view[16];
+		mat4x4::identity_matrix(camera_rotation);
+		mat4x4::rotation_x(camera_rot[0], camera_rx);
+		mat4x4::rotation_y(camera_rot[1], camera_ry);
+		mat4x4::mult_mat(camera_rx, camera_ry, camera_rotation);
+		mat4x4::quick_inverse(camera_rotation, camera_view);
+
+		if (mode == RAYCAST) {
+			unit_faces = 0;
+			merged_faces = 0;
+			triangles = 0;
+			march(camera_pos, camera_rotation);
+			return;
+		}
+
+		/* Frustum planes, in camera relative world coordinates */
+		float view_projection[16], planes[6][4];
+		mat4x4::mult_mat(camera_view, projection, view_projection);
+		frustum::planes(view_projection, planes);
+
+		/* Init triangles to render */
+		ArenaArray<vec3::Triangle> rendered_triangles(arena);
+		/*
+		*  Init visible faces, and the direction of each face
+		*  A face is a triangle fan of face_sizes vertices from face_first in the batch
+		*/
+		transform::Batch batch(arena);
+		ArenaArray<uint8_t> face_dirs(arena);
+		ArenaArray<uint32_t> face_first(arena), face_sizes(arena);
+		/* Faces in range, before and after greedy merging */
+		unit_faces = 0;
+		merged_faces = 0;
+
+		/* Only visit the chunks overlapping the view, using their cached meshes */
+		{
+			PROFILE_ZONE("world scan");
+			meshes.collect();
+			/* Meshes are kept for the chunks in range only, trimmed when the camera changes chunk */
+			int ccx = world::chunk_coord((int)floorf(camera_pos[0])), ccz = world::chunk_coord((int)floorf(camera_pos[2]));
+			int radius = (int)ceilf(distance / world::chunk_size) + 1;
+			if (ccx != mesh_cx || ccz != mesh_cz || radius != mesh_radius) {
+				meshes.evict_far(ccx, ccz, radius);
+				mesh_cx = ccx;
+				mesh_cz = ccz;
+				mesh_radius = radius;
+			}
+			chunks.for_each_chunk(camera_pos[0] - distance, camera_pos[2] - distance,
+				camera_pos[0] + distance, camera_pos[2] + distance, [&](const world::Chunk* chunk) {
+				/* Skip chunks outside of the frustum */
+				float min[3], max[3];
+				chunk->bounds(min, max);
+				vec3::inv_translate(min, camera_pos, min);
+				vec3::inv_translate(max, camera_pos, max);
+				if (!frustum::aabb_visible(planes, min, max))
+					return;
+
+				/* Level of detail from the nearest point of the chunk, on the x and z axes */
+				float dx = fmaxf(fmaxf(min[0], -max[0]), 0.0f), dz = fmaxf(fmaxf(min[2], -max[2]), 0.0f);
+				int level = mesh::lod_level(fmaxf(dx, dz), lod_distance);
+				const mesh::ChunkMesh& chunk_mesh = meshes.get(chunks, chunk, level);
+				const uint8_t* outline = chunk_mesh.outlines.data();
+				for (const mesh::Face& face : chunk_mesh.faces) {
+					const uint8_t* points = outline;
+					outline += 2 * face.outline;
+					if (mesh::face_in_range(face, camera_pos[0], camera_pos[2], distance)) {
+						unit_faces += face.w * face.h;
+						merged_faces++;
+
+						/* Face corners, relative to the camera */
+						float corners[4][4];
+						mesh::face_corners(face, corners);
+						for (int i = 0; i < 4; i++)
+							vec3::inv_translate(corners[i], camera_pos, corners[i]);
+
+						/* Determine if the face is facing the camera */
+						if (vec3::dot(corners[0], mesh::normals[face.dir]) >= 0.0)
+							continue;
+
+						/* Skip faces outside of the frustum */
+						frustum::bounds(corners, 4, min, max);
+						if (!frustum::aabb_visible(planes, min, max))
+							continue;
+
+						/* Queue the corners for the batch transform */
+						face_first.push_back(batch.count);
+						face_dirs.push_back(face.dir);
+						int a0, b0, a1, b1;
+						bool cut = mesh::face_clamp(face, camera_pos[0], camera_pos[2], distance, a0, b0, a1, b1);
+						if (face.outline == 0 && !cut) {
+							for (int i = 0; i < 4; i++)
+								batch.push(corners[i]);
+							face_sizes.push_back(4);
+							continue;
+						}
+
+						/*
+						*  Split faces, and merged faces crossing the render distance, are a fan
+						*  from their centre around the outline, closed, cut to the blocks in range
+						*/
+						const int count = face.outline ? face.outline : 4;
+						float point[4];
+						mesh::face_point(face, (a0 + a1) * 0.5f, (b0 + b1) * 0.5f, point);
+						vec3::inv_translate(point, camera_pos, point);
+						batch.push(point);
+						for (int i = 0; i <= count; i++) {
+							int a, b;
+							if (face.outline) {
+								a = points[2 * (i % count)];
+								b = points[2 * (i % count) + 1];
+							}
+							else
+								mesh::corner_offset(face, i % count, a, b);
+							a = a < a0 ? a0 : (a > a1 ? a1 : a);
+							b = b < b0 ? b0 : (b > b1 ? b1 : b);
+							mesh::face_point(face, (float)a, (float)b, point);
+							vec3::inv_translate(point, camera_pos, point);
+							batch.push(point);
+						}
+						face_sizes.push_back(count + 2);
+					}
+				}
+			});
+		}
+
+		/* Project every queued vertex to clip and screen space at once */
+		{
+			PROFILE_ZONE("transform");
+			transform::project(batch, view_projection, width, height);
+		}
+
+		/* For each of the two triangles of each face */
+		{
+			PROFILE_ZONE("clip");
+			for (int f = 0; f < face_dirs.size(); f++) {
+				for (int i = 1; i + 1 < (int)face_sizes[f]; i++) {
+					const int first = (int)face_first[f];
+					const int indexes[3] = { first, first + i, first + i + 1 };
+					vec3::Triangle triangle;
+					triangle.fill = face_shades[face_dirs[f]];
+
+					/* Triangles inside the screen use the batch screen positions */
+					float vertex_projection[3][4];
+					uint8_t outcodes = 0;
+					for (int j = 0; j < 3; j++) {
+						batch.clip(indexes[j], vertex_projection[j]);
+						outcodes |= clip::outcode(vertex_projection[j]);
+					}
+					if (outcodes == 0) {
+						for (int j = 0; j < 3; j++) {
+							triangle.points[j][0] = batch.sx[indexes[j]];
+							triangle.points[j][1] = batch.sy[indexes[j]];
+							triangle.points[j][2] = batch.iw[indexes[j]];
+						}
+						rendered_triangles.push_back(triangle);
+						continue;
+					}
+
+					/* Clip against the near plane and the screen edges */
+					clip::Polygon polygon;
+					if (clip::clip_triangle(vertex_projection[0], vertex_projection[1], vertex_projection[2], polygon) < 3)
+						continue;
+
+					/* Denormalize coordinates, and invert depth for rasterizing */
+					float screen_pos[clip::max_vertices][3];
+					for (int j = 0; j < polygon.count; j++)
+						clip::viewport(polygon.v[j], width, height, screen_pos[j]);
+
+					/* Save the clipped polygon as a triangle fan */
+					for (int j = 1; j + 1 < polygon.count; j++) {
+						const int fan[3] = { 0, j, j + 1 };
+						for (int k = 0; k < 3; k++)
+							vec3::cpy3(screen_pos[fan[k]], triangle.points[k]);
+						rendered_triangles.push_back(triangle);
+					}
+				}
+			}
+		}
+
+		/* Draw the triangles */
+		{
+			PROFILE_ZONE("raster");
+			if (wireframe) {
+				for (int i = 0; i < rendered_triangles.size(); i++) {
+					const float(*v)[3] = rendered_triangles[i].points;
+					for (int j = 0; j < 3; j++)
+						Line(v[j][0], v[j][1], v[(j + 1) % 3][0], v[(j + 1) % 3][1], rendered_triangles[i].fill);
+				}
+			}
+			else {
+				/* Bin triangles per tile, then rasterize the tiles in parallel */
+				tiles.clear(arena);
+				for (int i = 0; i < rendered_triangles.size(); i++)
+					tiles.add(i, rendered_triangles[i].points[0], rendered_triangles[i].points[1], rendered_triangles[i].points[2]);
+				pool.run(tiles.count(), [&](int tile) {
+					PROFILE_ZONE("tile");
+					int x0, y0, x1, y1;
+					tiles.rect(tile, x0, y0, x1, y1);
+					for (uint32_t i : tiles.bins[tile]) {
+						const vec3::Triangle& triangle = rendered_triangles[i];
+						raster::triangle(triangle.points[0], triangle.points[1], triangle.points[2], triangle.fill, buffer, depth_buffer, stride, x0, y0, x1, y1);
+					}
+				});
+			}
+		}
+		triangles = rendered_triangles.size();
+	}
+
+	/*
+	*  Cast a ray through the center of every cell, rows in parallel,
+	*  and fill the cell with the char of the face it hits first
+	*  Rays stop where they leave the render distance square, so the
+	*  frame covers the same blocks as the triangle path
+	*/
+	void march(const float camera_pos[4], const float camera_rotation[16]) {
+		PROFILE_ZONE("raycast");
+		/* Inverse of the projection and viewport, the centre of cell (x, y) looks along (ndc_x / (aspect * f), ndc_y / f, 1) */
+		const float f = 1.0f / tanf(fov * 0.5f / 180.0f * (float)M_PI);
+		const float fx = (float)width / ((float)height * f), fy = 1.0f / f;
+		const float* r = camera_rotation;
+		const float range = distance + 0.5f;
+		pool.run(height, [&](int y) {
+			const float cy = (1.0f - 2.0f * (y + 0.5f) / height) * fy;
+			for (int x = 0; x < width; x++) {
+				const float cx = (2.0f * (x + 0.5f) / width - 1.0f) * fx;
+				/* Camera to world, row vector times the rotation */
+				float dir[3];
+				for (int j = 0; j < 3; j++)
+					dir[j] = cx * r[j] + cy * r[4 + j] + r[8 + j];
+				float length = sqrtf(cx * cx + cy * cy + 1.0f);
+				float max_distance = fminf(fabsf(dir[0]) > 0.0f ? range * length / fabsf(dir[0]) : INFINITY,
+					fabsf(dir[2]) > 0.0f ? range * length / fabsf(dir[2]) : INFINITY);
+
+				raycast::Hit hit;
+				if (!raycast::cast(chunks, camera_pos, dir, max_distance, hit) || hit.face < 0)
+					continue;
+				if (fabsf(hit.x - camera_pos[0]) > distance || fabsf(hit.z - camera_pos[2]) > distance)
+					continue;
+				/* Inverted camera space z, like the triangle path */
+				buffer[y * stride + x] = face_shades[hit.face];
+				depth_buffer[y * stride + x] = length / fmaxf(hit.distance, zNear);
+			}
+		});
+	}
+
+	/*
+	* Temporary line algorithm
+	*/
+	void Line(float x1, float y1, float x2, float y2, wchar_t c = '.')
+	{
+		/* Vertices on the right and bottom screen edges fall in the last column and row */
+		x1 = fminf(x1, width - 1.0f);
+		x2 = fminf(x2, width - 1.0f);
+		y1 = fminf(y1, height - 1.0f);
+		y2 = fminf(y2, height - 1.0f);
+
+		const bool steep = (fabs(y2 - y1) > fabs(x2 - x1));
+
+		if (steep) {
+			std::swap(x1, y1);
+			std::swap(x2, y2);
+		}
+
+		if (x1 > x2) {
+			std::swap(x1, x2);
+			std::swap(y1, y2);
+		}
+
+		const float dx = x2 - x1;
+		const float dy = fabs(y2 - y1);
+		float error = dx / 2.0f;
+
+		const int ystep = (y1 < y2) ? 1 : -1;
+		int y = (int)y1;
+		const int maxX = (int)x2;
+
+		for (int x = (int)x1; x <= maxX; x++) {
+
+			if (steep) {
+				buffer[x * stride + y] = c;
+			}
+			else {
+				buffer[y * stride + x] = c;
+			}
+
+			error -= dy;
+			if (error < 0) {
+				y += ystep;
+				error += dx;
+			}
+		}
+	}
+
+private:
+	world::World& chunks;
+	/* Allocation holding both buffers */
+	char* memory = nullptr;
+	mesh::MeshCache meshes;
+	/* Camera chunk and radius the meshes were last trimmed to, see MeshCache::evict_far */
+	int mesh_cx = 0, mesh_cz = 0, mesh_radius = -1;
+	ThreadPool pool;
+	raster::Tiles tiles;
+	float projection[16];
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "profiler.h"
+using namespace std;
+
+/**
+* Dynamic resolution, holds a frame time budget by changing the render
+* distance and the internal render resolution, the frame is then scaled
+* up to the output size
+*/
+namespace scaling {
+
+	/*
+	* Frame time controller
+	* The frame time is smoothed, and a change needs the average to stay
+	* past its threshold for several frames. Going down needs a few frames
+	* over budget, going up many frames well under it, and every change is
+	* followed by a cooldown, so the settings do not oscillate
+	* An upgrade undone soon after doubles the wait before the next one
+	* Over budget the render distance is lowered first, then the resolution,
+	* under budget the resolution comes back first
+	*/
+	class Controller
+	{
+	public:
+		/* Frame time to hold, in milliseconds */
+		float budget;
+		/* Fraction of the budget above which frames are too slow, and below which they are fast enough to go up */
+		float high = 1.05f, low = 0.7f;
+		/* Consecutive frames past a threshold before going down or up, and frames ignored after a change */
+		int down_frames = 5, up_frames = 30, cooldown_frames = 10;
+		/* Weight of the last frame in the smoothed frame time */
+		float smoothing = 0.2f;
+
+		/* Internal resolution, as a fraction of the output size on each axis */
+		float scale = 1.0f;
+		float min_scale = 0.5f, scale_step = 0.125f;
+		/* Render distance, and the factor it changes by */
+		float distance, min_distance, max_distance;
+		float distance_step = 0.8f;
+
+		/* Smoothed frame time, in milliseconds */
+		float average = 0.0f;
+		/* Changes since creation, and the last one */
+		uint32_t downgrades = 0, upgrades = 0;
+		const char* decision = "hold";
+
+		Controller(float budget, float distance, float min_distance, float max_distance) {
+			this->budget = budget;
+			this->distance = distance;
+			this->min_distance = min_distance;
+			this->max_distance = max_distance;
+		}
+
+		/*
+		*  Add the time of the last frame, from PROF_COUNTER, call once per frame
+		*  Returns true when scale or distance changed for the next frame
+		*  Decisions are recorded as profiler counters
+		*/
+		bool update(double frame_ms) {
+			PROFILE_ZONE("scaling");
+			if (up_wait == 0)
+				up_wait = up_frames;
+			if (since_upgrade < 1 << 30)
+				since_upgrade++;
+			if (cooldown > 0) {
+				cooldown--;
+				average = 0.0f;
+				return false;
+			}
+			average = average == 0.0f ? (float)frame_ms : average + smoothing * ((float)frame_ms - average);
+			slow = average > budget * high ? slow + 1 : 0;
+			fast = average < budget * low ? fast + 1 : 0;
+
+			bool changed = false;
+			if (slow >= down_frames) {
+				if (distance > min_distance) {
+					distance = fmaxf(distance * distance_step, min_distance);
+					decision = "distance down";
+					changed = true;
+				}
+				else if (scale > min_scale) {
+					scale = fmaxf(scale - scale_step, min_scale);
+					decision = "scale down";
+					changed = true;
+				}
+				downgrades += changed;
+				if (changed && since_upgrade < 2 * up_wait)
+					up_wait = min(2 * up_wait, 8 * up_frames);
+			}
+			else if (fast >= up_wait) {
+				if (scale < 1.0f) {
+					scale = fminf(scale + scale_step, 1.0f);
+					decision = "scale up";
+					changed = true;
+				}
+				else if (distance < max_distance) {
+					distance = fminf(distance / distance_step, max_distance);
+					decision = "distance up";
+					changed = true;
+				}
+				upgrades += changed;
+				if (changed)
+					since_upgrade = 0;
+			}
+			if (changed) {
+				slow = 0;
+				fast = 0;
+				cooldown = cooldown_frames;
+				profiler::counter("scale", scale);
+				profiler::counter("render distance", distance);
+			}
+			profiler::counter("frame average ms", average);
+			return changed;
+		}
+
+		/* Internal size for an output size, at least 1x1 */
+		inline void internal_size(int width, int height, int& out_width, int& out_height) const {
+			out_width = (int)(width * scale + 0.5f);
+			out_height = (int)(height * scale + 0.5f);
+			if (out_width < 1)
+				out_width = 1;
+			if (out_height < 1)
+				out_height = 1;
+		}
+
+		/* "scale s distance d decision", for titles */
+		inline int format(char* out, size_t size) const {
+			return snprintf(out, size, "scale %.2f distance %.0f %s", scale, distance, decision);
+		}
+
+	private:
+		int slow = 0, fast = 0, cooldown = 0;
+		/* Fast frames needed to go up, and frames since the last upgrade */
+		int up_wait = 0, since_upgrade = 1 << 30;
+	};
+
+	/*
+	* Nearest neighbour upscaling of a char buffer to the output size
+	* The source column and row of every output cell are precomputed
+	* when the sizes change, so scaling a frame is a table lookup per cell
+	*/
+	class Upscaler
+	{
+	public:
+		int width = 0, height = 0;
+		/* Output frame, height rows of width chars */
+		vector<wchar_t> buffer;
+
+		/* Scale a source frame of height rows, stride chars apart, to width x height */
+		const wchar_t* scale(const wchar_t* source, int source_width, int source_height, int stride, int width, int height) {
+			PROFILE_ZONE("upscale");
+			if (width != this->width || height != this->height || source_width != this->source_width || source_height != this->source_height) {
+				this->width = width;
+				this->height = height;
+				this->source_width = source_width;
+				this->source_height = source_height;
+				buffer.resize((size_t)width * height);
+				columns.resize(width);
+				rows.resize(height);
+				for (int x = 0; x < width; x++)
+					columns[x] = (int)((int64_t)x * source_width / width);
+				for (int y = 0; y < height; y++)
+					rows[y] = (int)((int64_t)y * source_height / height);
+			}
+			for (int y = 0; y < height; y++) {
+				const wchar_t* row = source + (size_t)rows[y] * stride;
+				wchar_t* out = buffer.data() + (size_t)y * width;
+				for (int x = 0; x < width; x++)
+					out[x] = row[columns[x]];
+			}
+			return buffer.data();
+		}
+
+	private:
+		int source_width = 0, source_height = 0;
+		vector<int> columns, rows;
+	};
+}
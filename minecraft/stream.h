@@ -0,0 +1,234 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "world.h"
+#include "profiler.h"
+using namespace std;
+
+/**
+* Streaming world, chunks are generated around the camera on background
+* threads and the farthest ones are evicted to stay within a memory budget
+*/
+namespace world {
+
+	class Streamer
+	{
+	public:
+		/* Chunks generated and evicted since creation */
+		uint32_t generated = 0, evicted = 0;
+		/* Memory used by the loaded chunks, recounted when evicting */
+		size_t bytes = 0;
+
+		/*
+		*  budget is the memory the chunks may use, in bytes, it is exceeded only
+		*  when the chunks around the camera alone do not fit
+		*  threads is the number of background generation threads
+		*/
+		Streamer(World& world, const Generator& generator, size_t budget, int threads = 2)
+			: world(world), generator(generator) {
+			this->budget = budget;
+			if (threads < 1)
+				threads = 1;
+			for (int i = 0; i < threads; i++)
+				workers.emplace_back(&Streamer::work, this);
+		}
+
+		~Streamer() {
+			{
+				lock_guard<mutex> lock(m);
+				stop = true;
+			}
+			requested.notify_all();
+			for (thread& t : workers)
+				t.join();
+			for (Chunk* c : done)
+				delete c;
+			for (Chunk* c : spare)
+				delete c;
+		}
+
+		Streamer(const Streamer&) = delete;
+		Streamer& operator=(const Streamer&) = delete;
+
+		/*
+		*  Call once per frame from the thread that renders the world
+		*  Adds the chunks generated since the last call, requests the missing
+		*  chunks within distance blocks of the camera, nearest first, and evicts
+		*  the farthest chunks outside of it when over budget
+		*  evict(cx, cz) is called for every evicted chunk, before it is freed
+		*/
+		template <typename F>
+		void update(const float camera_pos[4], float distance, F evict) {
+			PROFILE_ZONE("stream");
+			int ccx = chunk_coord((int)floorf(camera_pos[0])), ccz = chunk_coord((int)floorf(camera_pos[2]));
+			int radius = (int)ceilf(distance / chunk_size) + 1;
+			if (radius != offsets_radius)
+				build_offsets(radius);
+
+			/* Take the finished chunks, and drop the requests not started yet */
+			{
+				lock_guard<mutex> lock(m);
+				finished.swap(done);
+				for (Chunk* c : finished)
+					pending.erase(chunk_key(c->cx, c->cz));
+				for (uint64_t key : queue)
+					pending.erase(key);
+				queue.clear();
+			}
+			for (Chunk* c : finished) {
+				if (world.insert(c)) {
+					bytes += c->memory();
+					generated++;
+				}
+				else
+					recycle(c);
+			}
+			finished.clear();
+
+			/* Request the missing chunks, nearest first */
+			bool requests;
+			{
+				lock_guard<mutex> lock(m);
+				for (const Offset& o : offsets) {
+					int cx = ccx + o.dx, cz = ccz + o.dz;
+					uint64_t key = chunk_key(cx, cz);
+					if (world.chunk(cx, cz) == nullptr && pending.insert(key).second)
+						queue.push_back(key);
+				}
+				requests = queue.size() > 0;
+			}
+			if (requests)
+				requested.notify_all();
+
+			if (bytes > budget)
+				evict_far(ccx, ccz, radius, evict);
+		}
+
+		/* Block until every requested chunk is generated, they are added by the next update */
+		void flush() {
+			unique_lock<mutex> lock(m);
+			idle.wait(lock, [this] { return queue.empty() && active == 0; });
+		}
+
+	private:
+		struct Offset
+		{
+			int dx, dz;
+		};
+
+		World& world;
+		const Generator& generator;
+		size_t budget;
+
+		/* Chunk offsets around the camera, sorted by distance */
+		vector<Offset> offsets;
+		int offsets_radius = -1;
+		/* Scratch lists, kept to avoid allocating every frame */
+		vector<Chunk*> finished;
+		vector<pair<int, Chunk*>> candidates;
+
+		/* Shared with the workers, guarded by m */
+		mutex m;
+		condition_variable requested, idle;
+		bool stop = false;
+		int active = 0;
+		deque<uint64_t> queue;
+		/* Queued or being generated */
+		unordered_set<uint64_t> pending;
+		vector<Chunk*> done;
+		/* Evicted chunks, reused by the workers */
+		vector<Chunk*> spare;
+		vector<thread> workers;
+
+		void build_offsets(int radius) {
+			offsets.clear();
+			for (int dz = -radius; dz <= radius; dz++)
+				for (int dx = -radius; dx <= radius; dx++)
+					offsets.push_back({ dx, dz });
+			sort(offsets.begin(), offsets.end(), [](const Offset& a, const Offset& b) {
+				return a.dx * a.dx + a.dz * a.dz < b.dx * b.dx + b.dz * b.dz;
+			});
+			offsets_radius = radius;
+		}
+
+		/* Keep a few evicted chunks for reuse, free the rest */
+		inline void recycle(Chunk* c) {
+			lock_guard<mutex> lock(m);
+			if (spare.size() < 64)
+				spare.push_back(c);
+			else
+				delete c;
+		}
+
+		/*
+		*  Evict the farthest chunks outside of the radius, down to 7/8 of
+		*  the budget so that eviction does not run every frame
+		*/
+		template <typename F>
+		void evict_far(int ccx, int ccz, int radius, F evict) {
+			/* Chunks grow when edits add blocks to their palette, recount */
+			bytes = 0;
+			candidates.clear();
+			for (auto& it : world.chunks) {
+				Chunk* c = it.second;
+				bytes += c->memory();
+				int d = max(abs(c->cx - ccx), abs(c->cz - ccz));
+				if (d > radius)
+					candidates.push_back({ d, c });
+			}
+			size_t target = budget - budget / 8;
+			sort(candidates.begin(), candidates.end(),
+				[](const pair<int, Chunk*>& a, const pair<int, Chunk*>& b) { return a.first > b.first; });
+			for (size_t i = 0; i < candidates.size() && bytes > target; i++) {
+				Chunk* c = candidates[i].second;
+				bytes -= c->memory();
+				evict(c->cx, c->cz);
+				world.remove(c->cx, c->cz);
+				recycle(c);
+				evicted++;
+			}
+		}
+
+		void work() {
+			unique_lock<mutex> lock(m);
+			while (1) {
+				requested.wait(lock, [this] { return stop || queue.size(); });
+				if (stop)
+					return;
+				uint64_t key = queue.front();
+				queue.pop_front();
+				active++;
+				Chunk* c = nullptr;
+				if (spare.size()) {
+					c = spare.back();
+					spare.pop_back();
+				}
+				lock.unlock();
+
+				int cx = (int)(uint32_t)(key >> 32), cz = (int)(uint32_t)key;
+				if (c == nullptr)
+					c = new Chunk(cx, cz);
+				else
+					c->reset(cx, cz);
+				generator.generate(*c);
+				/* Clean, the generator can make it again */
+				c->saved_revision = c->revision;
+
+				lock.lock();
+				/* Stays pending until update takes it, so it is not requested twice */
+				done.push_back(c);
+				active--;
+				if (queue.empty() && active == 0)
+					idle.notify_all();
+			}
+		}
+	};
+}
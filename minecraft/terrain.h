@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include "threads.h"
+#include "world.h"
+#include "noise.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TERRAIN_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERRAIN_SSE
+#endif
+
+/* Noise generation functions used to create map */
+#define smooth(t) (t*t*t*(t*(t*6.0f-15.0f)+10.0f))
+#define ffloor(x) (((x)>=0) ? ((int)x) : ((int)x- 1))
+#define lerp(t, a, b) ((a)+(t)*((b)-(a)))
+#define xorshift32(x) (x^(x<<13)^((x^(x<<13))>>17))^((x^(x<<13)^((x^(x<<13))>>17))<<5);
+
+/*
+*  Generate uint32_t n^2 random grid, O(n^2)
+*  Used later for interpolation on a 100n^2 map
+*/
+inline int* generate_grid(uint32_t& seed, const int size) {
+	int* grid = new int[size * size];
+	for (int i = 0; i < ceil((size * size) / 10.0f); i++) {
+		/* Iterate xor shift */
+		seed = xorshift32(seed);
+		/* Make sure the value is 10 digits */
+		if (seed <= 1e9)
+			seed += (uint32_t)1147483647;
+		/* Extract the 10 digits */
+		uint32_t n = seed, rem;
+		for (int j = 0; j < 10; ++j) {
+			rem = n % 10;
+			n = n / 10;
+			grid[(10 * i + j) % (size * size)] = rem;
+		}
+	}
+	return grid;
+}
+
+/*
+*  Height of a single map cell, the formula interpolate_grid evaluates
+*  for every cell of the map
+*/
+inline int interpolate(const int* grid, const int size, int x, int y) {
+	/* Find corners */
+	float px = (float)x / 10.0f;
+	float py = (float)y / 10.0f;
+	int fx = ffloor(px);
+	int fy = ffloor(py);
+
+	/* Interpolate on the x axis */
+	float l1 = lerp(px - fx, (float)grid[(size * fy + fx) % (size * size)],
+		(float)grid[(size * fy + fx + 1) % (size * size)]);
+	float l2 = lerp(px - fx, (float)grid[(size * (fy + 1) + fx) % (size * size)],
+		(float)grid[(size * (fy + 1) + fx + 1) % (size * size)]);
+
+	/* Interpolate on the y axis, using smooth function */
+	float t = py - fy < 1.0f ? py - fy : 1.0;
+	return (int)ffloor(lerp(smooth(t), l1, l2));
+}
+
+/*
+*  Interpolate the rows [y0, y1) of the map, the same arithmetic as the
+*  scalar formula, so the output is bit-identical to it:
+*  ffloor(lerp(smooth(ty), lerp(tx, g00, g01), lerp(tx, g10, g11))) in float
+*  The x lerps only depend on the grid row, they are cached per grid row,
+*  and smooth(ty) is constant along a row
+*/
+inline void interpolate_rows(const int* grid, const int size, const float* tx, const int* fx, int* map, int y0, int y1) {
+	const int columns = size * 10;
+	float* l1 = new float[2 * (size_t)columns];
+	float* d = l1 + columns;
+	int cached = -1;
+	for (int y = y0; y < y1; y++) {
+		float py = (float)y / 10.0f;
+		int fy = ffloor(py);
+		if (fy != cached) {
+			cached = fy;
+			for (int x = 0; x < columns; x++) {
+				/* Interpolate on the x axis */
+				float a = lerp(tx[x], (float)grid[(size * fy + fx[x]) % (size * size)],
+					(float)grid[(size * fy + fx[x] + 1) % (size * size)]);
+				float b = lerp(tx[x], (float)grid[(size * (fy + 1) + fx[x]) % (size * size)],
+					(float)grid[(size * (fy + 1) + fx[x] + 1) % (size * size)]);
+				l1[x] = a;
+				d[x] = b - a;
+			}
+		}
+
+		/* Interpolate on the y axis, using smooth function */
+		float t = py - fy < 1.0f ? py - fy : 1.0;
+		float s = smooth(t);
+		int* row = map + (size_t)y * columns;
+		int x = 0;
+#if defined(TERRAIN_AVX)
+		const __m256 vs = _mm256_set1_ps(s);
+		for (; x + 8 <= columns; x += 8) {
+			__m256 v = _mm256_add_ps(_mm256_loadu_ps(l1 + x), _mm256_mul_ps(vs, _mm256_loadu_ps(d + x)));
+			_mm256_storeu_si256((__m256i*)(row + x), _mm256_cvttps_epi32(v));
+		}
+#elif defined(TERRAIN_SSE)
+		const __m128 vs = _mm_set1_ps(s);
+		for (; x + 4 <= columns; x += 4) {
+			__m128 v = _mm_add_ps(_mm_loadu_ps(l1 + x), _mm_mul_ps(vs, _mm_loadu_ps(d + x)));
+			_mm_storeu_si128((__m128i*)(row + x), _mm_cvttps_epi32(v));
+		}
+#endif
+		/* The values are >= 0, so truncating floors them */
+		for (; x < columns; x++)
+			row[x] = (int)(l1[x] + s * d[x]);
+	}
+	delete[] l1;
+}
+
+/*
+*  Interpolate n^2 random grid into a 100n^2 map
+*  using blinear interpolation and smooth functions
+*  Bands of rows are interpolated in parallel, threads <= 0 uses every hardware thread
+*/
+inline int* interpolate_grid(const int* grid, const int size, int threads = 0) {
+	/* Interpolated Map */
+	const int columns = size * 10;
+	int* map = new int[100 * (size_t)size * size];
+
+	/* Position of each column in the grid cell it falls in */
+	float* tx = new float[columns];
+	int* fx = new int[columns];
+	for (int x = 0; x < columns; x++) {
+		float px = (float)x / 10.0f;
+		fx[x] = ffloor(px);
+		tx[x] = px - fx[x];
+	}
+
+	ThreadPool pool(threads);
+	const int band = 64;
+	pool.run((columns + band - 1) / band, [&](int i) {
+		interpolate_rows(grid, size, tx, fx, map, i * band, min(columns, (i + 1) * band));
+	});
+	delete[] tx;
+	delete[] fx;
+	return map;
+}
+
+/*
+*  Terrain from a random grid, chunk by chunk, without building the map
+*  The map repeats every 10 * size blocks, inside the first repetition
+*  the chunks match what load_heightmap builds from interpolate_grid
+*/
+class GridGenerator : public world::Generator
+{
+public:
+	GridGenerator(uint32_t seed, int size) {
+		this->size = size;
+		grid = generate_grid(seed, size);
+	}
+
+	~GridGenerator() { delete[] grid; }
+
+	void generate(world::Chunk& chunk) const override {
+		const int period = 10 * size;
+		uint8_t blocks[world::chunk_volume] = {};
+		for (int z = 0; z < world::chunk_size; z++) {
+			for (int x = 0; x < world::chunk_size; x++) {
+				int wx = (chunk.cx * world::chunk_size + x) % period, wz = (chunk.cz * world::chunk_size + z) % period;
+				world::fill_column(blocks, x, z, interpolate(grid, size, wx < 0 ? wx + period : wx, wz < 0 ? wz + period : wz));
+			}
+		}
+		chunk.write(blocks);
+	}
+
+private:
+	int size;
+	int* grid;
+};
+
+/*
+*  Terrain from fBm gradient noise, defined for every column of the world
+*  and not repeating within the 32 bit lattice, a row of a chunk is
+*  evaluated 8 columns at a time
+*/
+class NoiseGenerator : public world::Generator
+{
+public:
+	/* Blocks per noise period of the first octave */
+	float scale = 48.0f;
+	/* Height at noise 0, and the height change at noise -1 and 1, the fBm rarely leaves [-0.6, 0.6] */
+	float base = 12.0f, amplitude = 24.0f;
+
+	NoiseGenerator(uint32_t seed) : noise(seed) {}
+
+	void generate(world::Chunk& chunk) const override {
+		float xs[world::chunk_size], zs[world::chunk_size], n[world::chunk_size];
+		uint8_t blocks[world::chunk_volume] = {};
+		for (int z = 0; z < world::chunk_size; z++) {
+			for (int x = 0; x < world::chunk_size; x++) {
+				xs[x] = (chunk.cx * world::chunk_size + x) / scale;
+				zs[x] = (chunk.cz * world::chunk_size + z) / scale;
+			}
+			noise.fbm(xs, zs, world::chunk_size, n);
+			for (int x = 0; x < world::chunk_size; x++)
+				world::fill_column(blocks, x, z, (int)floorf(base + amplitude * n[x]));
+		}
+		chunk.write(blocks);
+	}
+
+private:
+	noise::Perlin noise;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/*
+* Persistent worker pool, runs an indexed job over every thread
+* The calling thread takes part in the job, so a pool of n threads
+* spawns n - 1 workers. Jobs are not copied, running one never allocates
+*/
+class ThreadPool
+{
+public:
+	/* threads <= 0 uses every hardware thread */
+	ThreadPool(int threads = 0) {
+		if (threads <= 0)
+			threads = (int)thread::hardware_concurrency();
+		for (int i = 1; i < threads; i++)
+			workers.emplace_back(&ThreadPool::work, this);
+	}
+
+	~ThreadPool() {
+		{
+			lock_guard<mutex> lock(m);
+			stop = true;
+		}
+		start.notify_all();
+		for (thread& t : workers)
+			t.join();
+	}
+
+	/* Number of threads running jobs, including the caller */
+	inline int size() const { return (int)workers.size() + 1; }
+
+	/*
+	*  Call f(i) for every i in [0, count), blocks until all are done
+	*  Indexes are handed out dynamically, f must be thread safe
+	*/
+	template <typename F>
+	void run(int count, const F& f) {
+		if (workers.empty() || count <= 1) {
+			for (int i = 0; i < count; i++)
+				f(i);
+			return;
+		}
+		{
+			lock_guard<mutex> lock(m);
+			job = &f;
+			invoke = [](const void* job, int i) { (*(const F*)job)(i); };
+			this->count = count;
+			next = 0;
+			active = (int)workers.size();
+			generation++;
+		}
+		start.notify_all();
+		execute();
+
+		unique_lock<mutex> lock(m);
+		done.wait(lock, [this] { return active == 0; });
+	}
+
+private:
+	vector<thread> workers;
+	mutex m;
+	condition_variable start, done;
+	bool stop = false;
+	uint64_t generation = 0;
+	int active = 0;
+
+	/* Current job */
+	const void* job = nullptr;
+	void (*invoke)(const void*, int) = nullptr;
+	int count = 0;
+	atomic<int> next{ 0 };
+
+	inline void execute() {
+		for (int i = next++; i < count; i = next++)
+			invoke(job, i);
+	}
+
+	void work() {
+		uint64_t seen = 0;
+		while (1) {
+			{
+				unique_lock<mutex> lock(m);
+				start.wait(lock, [&] { return stop || generation != seen; });
+				if (stop)
+					return;
+				seen = generation;
+			}
+			execute();
+			lock_guard<mutex> lock(m);
+			if (--active == 0)
+				done.notify_one();
+		}
+	}
+};
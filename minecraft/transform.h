@@ -0,0 +1,190 @@
+#pragma once
+
+#include <math.h>
+#include "mat.h"
+#include "clip.h"
+#include "arena.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORM_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_SSE
+#endif
+
+/**
+* Batched vertex transform, structure of arrays with SSE/AVX kernels
+*/
+namespace transform {
+
+	/*
+	* Vertex batch, each attribute is stored in its own array
+	* Backed by a frame arena, valid until it is reset
+	*/
+	class Batch
+	{
+	public:
+		int count = 0;
+		/* Input positions, w is always 1 */
+		ArenaArray<float> x, y, z;
+		/* Clip space positions, allocated by project */
+		float* cx = nullptr, * cy = nullptr, * cz = nullptr, * cw = nullptr;
+		/* Screen positions (x, y, 1/w), valid when the vertex is inside the clip volume */
+		float* sx = nullptr, * sy = nullptr, * iw = nullptr;
+
+		Batch(Arena& arena) : x(arena), y(arena), z(arena) { this->arena = &arena; }
+
+		/* Append a vertex, returns its index */
+		inline int push(const float v[4]) {
+			x.push_back(v[0]);
+			y.push_back(v[1]);
+			z.push_back(v[2]);
+			return count++;
+		}
+
+		/* Allocate the output arrays */
+		inline void allocate_outputs() {
+			float* memory = arena->alloc_array<float>(7 * (size_t)count + 1);
+			float** outputs[7] = { &cx, &cy, &cz, &cw, &sx, &sy, &iw };
+			for (int i = 0; i < 7; i++)
+				*outputs[i] = memory + i * (size_t)count;
+		}
+
+		/* Clip space position of a vertex */
+		inline void clip(int i, float out[4]) const {
+			out[0] = cx[i];
+			out[1] = cy[i];
+			out[2] = cz[i];
+			out[3] = cw[i];
+		}
+
+	private:
+		Arena* arena;
+	};
+
+	/* Transform and project vertices [begin, end) one at a time */
+	inline void project_scalar(Batch& b, int begin, int end, const float mat[16], int width, int height) {
+		for (int i = begin; i < end; i++) {
+			float v[4] = { b.x[i], b.y[i], b.z[i], 1.0f }, c[4], s[3];
+			mat4x4::mult_vec(mat, v, c);
+			clip::viewport(c, width, height, s);
+			b.cx[i] = c[0];
+			b.cy[i] = c[1];
+			b.cz[i] = c[2];
+			b.cw[i] = c[3];
+			b.sx[i] = s[0];
+			b.sy[i] = s[1];
+			b.iw[i] = s[2];
+		}
+	}
+
+#if defined(TRANSFORM_AVX)
+	/* 8 vertices per instruction */
+	inline int project_simd(Batch& b, int n, const float mat[16], int width, int height) {
+		__m256 m[16];
+		for (int i = 0; i < 16; i++)
+			m[i] = _mm256_set1_ps(mat[i]);
+		const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+		const __m256 half_w = _mm256_set1_ps(width * 0.5f), half_h = _mm256_set1_ps(height * 0.5f);
+		const __m256 max_x = _mm256_set1_ps((float)width), max_y = _mm256_set1_ps((float)height);
+		int i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m256 x = _mm256_loadu_ps(b.x.data + i), y = _mm256_loadu_ps(b.y.data + i), z = _mm256_loadu_ps(b.z.data + i);
+			__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m[0]), _mm256_mul_ps(y, m[4])), _mm256_mul_ps(z, m[8])), m[12]);
+			__m256 cy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m[1]), _mm256_mul_ps(y, m[5])), _mm256_mul_ps(z, m[9])), m[13]);
+			__m256 cz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m[2]), _mm256_mul_ps(y, m[6])), _mm256_mul_ps(z, m[10])), m[14]);
+			__m256 cw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m[3]), _mm256_mul_ps(y, m[7])), _mm256_mul_ps(z, m[11])), m[15]);
+			__m256 iw = _mm256_div_ps(one, cw);
+			__m256 sx = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(cx, iw), one), half_w);
+			__m256 sy = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(cy, iw)), half_h);
+			sx = _mm256_min_ps(_mm256_max_ps(sx, zero), max_x);
+			sy = _mm256_min_ps(_mm256_max_ps(sy, zero), max_y);
+			_mm256_storeu_ps(b.cx + i, cx);
+			_mm256_storeu_ps(b.cy + i, cy);
+			_mm256_storeu_ps(b.cz + i, cz);
+			_mm256_storeu_ps(b.cw + i, cw);
+			_mm256_storeu_ps(b.sx + i, sx);
+			_mm256_storeu_ps(b.sy + i, sy);
+			_mm256_storeu_ps(b.iw + i, iw);
+		}
+		return i;
+	}
+#elif defined(TRANSFORM_SSE)
+	/* 4 vertices per instruction */
+	inline int project_simd(Batch& b, int n, const float mat[16], int width, int height) {
+		__m128 m[16];
+		for (int i = 0; i < 16; i++)
+			m[i] = _mm_set1_ps(mat[i]);
+		const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+		const __m128 half_w = _mm_set1_ps(width * 0.5f), half_h = _mm_set1_ps(height * 0.5f);
+		const __m128 max_x = _mm_set1_ps((float)width), max_y = _mm_set1_ps((float)height);
+		int i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m128 x = _mm_loadu_ps(b.x.data + i), y = _mm_loadu_ps(b.y.data + i), z = _mm_loadu_ps(b.z.data + i);
+			__m128 cx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[0]), _mm_mul_ps(y, m[4])), _mm_mul_ps(z, m[8])), m[12]);
+			__m128 cy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[1]), _mm_mul_ps(y, m[5])), _mm_mul_ps(z, m[9])), m[13]);
+			__m128 cz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[2]), _mm_mul_ps(y, m[6])), _mm_mul_ps(z, m[10])), m[14]);
+			__m128 cw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[3]), _mm_mul_ps(y, m[7])), _mm_mul_ps(z, m[11])), m[15]);
+			__m128 iw = _mm_div_ps(one, cw);
+			__m128 sx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cx, iw), one), half_w);
+			__m128 sy = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(cy, iw)), half_h);
+			sx = _mm_min_ps(_mm_max_ps(sx, zero), max_x);
+			sy = _mm_min_ps(_mm_max_ps(sy, zero), max_y);
+			_mm_storeu_ps(b.cx + i, cx);
+			_mm_storeu_ps(b.cy + i, cy);
+			_mm_storeu_ps(b.cz + i, cz);
+			_mm_storeu_ps(b.cw + i, cw);
+			_mm_storeu_ps(b.sx + i, sx);
+			_mm_storeu_ps(b.sy + i, sy);
+			_mm_storeu_ps(b.iw + i, iw);
+		}
+		return i;
+	}
+#else
+	inline int project_simd(Batch& b, int n, const float mat[16], int width, int height) { return 0; }
+#endif
+
+	/*
+	*  Transform every vertex of the batch by a pre-multiplied view x projection
+	*  matrix, then apply the perspective divide and the viewport mapping
+	*/
+	inline void project(Batch& b, const float mat[16], int width, int height) {
+		b.allocate_outputs();
+		int done = project_simd(b, b.count, mat, width, height);
+		project_scalar(b, done, b.count, mat, width, height);
+	}
+
+	/*
+	*  Check the batch transform against mat4x4::mult_vec (view, then projection)
+	*  and clip::viewport on a grid of points, returns false on mismatch
+	*/
+	inline bool verify(const float view[16], const float projection[16], int width, int height) {
+		float view_projection[16];
+		mat4x4::mult_mat(view, projection, view_projection);
+		Arena arena(1 << 16);
+		Batch b(arena);
+		for (int i = 0; i < 1000; i++) {
+			float v[4] = { (float)(i % 10) - 4.5f, (float)(i / 10 % 10) - 4.5f, (float)(i / 100) + 0.25f, 1.0f };
+			b.push(v);
+		}
+		project(b, view_projection, width, height);
+		for (int i = 0; i < b.count; i++) {
+			float v[4] = { b.x[i], b.y[i], b.z[i], 1.0f }, rotated[4], expected[4], screen[3];
+			mat4x4::mult_vec(view, v, rotated);
+			mat4x4::mult_vec(projection, rotated, expected);
+			float c[4];
+			b.clip(i, c);
+			for (int k = 0; k < 4; k++)
+				if (fabsf(c[k] - expected[k]) > 1e-3f * (1.0f + fabsf(expected[k])))
+					return false;
+			if (expected[3] <= 0.0f)
+				continue;
+			clip::viewport(expected, width, height, screen);
+			if (fabsf(b.sx[i] - screen[0]) > 0.05f || fabsf(b.sy[i] - screen[1]) > 0.05f ||
+				fabsf(b.iw[i] - screen[2]) > 1e-3f * fabsf(screen[2]))
+				return false;
+		}
+		return true;
+	}
+}
@@ -11,17 +11,14 @@ using namespace std;
 */
 namespace vec3  {
 
-	class Triangle
+	/*
+	* Screen space triangle, each point is (x, y, inverted w for rasterizing)
+	* Plain data, so that render lists can live in a frame arena
+	*/
+	struct Triangle
 	{
-	public:
-		std::vector<vector<float>> points;
-		float w[3];
-		Triangle() {
-			this->points = vector<vector<float>>();
-			w[0] = 1.0;
-			w[1] = 1.0;
-			w[2] = 1.0;
-		}
+		float points[3][3];
+		wchar_t fill;
 	};
 
 	inline bool cmpf(float f0, float f1, float d = 0.005f) { 
@@ -41,6 +38,12 @@ namespace vec3  {
 		out[3] = v[3];
 	}
 
+	inline void cpy3(const float v[3], float out[3]) {
+		out[0] = v[0];
+		out[1] = v[1];
+		out[2] = v[2];
+	}
+
 	inline void zero(float out[4]) {
 		out[0] = 0.0f;
 		out[1] = 0.0f;
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "palette.h"
+using namespace std;
+
+/**
+* Chunked voxel world storage
+*/
+namespace world {
+
+	/* Chunk dimensions, chunks are 16x16 columns of chunk_height blocks */
+	const int chunk_shift = 4;
+	const int chunk_size = 1 << chunk_shift;
+	const int chunk_mask = chunk_size - 1;
+	const int chunk_height = 32;
+	const int chunk_volume = chunk_size * chunk_size * chunk_height;
+
+	/* Block types */
+	const uint8_t AIR = 0;
+	const uint8_t GROUND = 1;
+
+	/* Chunk coordinate of a world block coordinate (floors negative values) */
+	inline int chunk_coord(int v) { return v >> chunk_shift; }
+	/* Block coordinate inside its chunk */
+	inline int local_coord(int v) { return v & chunk_mask; }
+
+	/* Pack chunk coordinates into a single hash key */
+	inline uint64_t chunk_key(int cx, int cz) {
+		return ((uint64_t)(uint32_t)cx << 32) | (uint64_t)(uint32_t)cz;
+	}
+
+	/*
+	*  New revision, from a counter shared by every chunk, so a revision is
+	*  never reused by another chunk, or by a chunk slot loaded again
+	*  Skips 0 when it wraps
+	*/
+	inline uint32_t next_revision() {
+		static atomic<uint32_t> counter{ 0 };
+		uint32_t r = counter.fetch_add(1, memory_order_relaxed) + 1;
+		return r ? r : counter.fetch_add(1, memory_order_relaxed) + 1;
+	}
+
+	/* Make a column of unpacked chunk blocks solid from the bottom up to height h, clamped to the chunk */
+	inline void fill_column(uint8_t* blocks, int x, int z, int h) {
+		h = h < 0 ? 0 : (h >= chunk_height ? chunk_height - 1 : h);
+		for (int y = 0; y <= h; y++)
+			blocks[(y * chunk_size + z) * chunk_size + x] = GROUND;
+	}
+
+	/*
+	* A 16x16 column of blocks, indexed [y][z][x]
+	* Blocks are palette indexes packed with 1 to 8 bits, see PaletteArray
+	*/
+	class Chunk
+	{
+	public:
+		int cx, cz;
+		/* Changed on every block change, see next_revision, 0 is never a valid revision */
+		uint32_t revision;
+		/* Revision last written to disk, or rebuilt by a generator */
+		uint32_t saved_revision;
+		/*
+		*  Changed when a block on a side of the chunk changes, sides are
+		*  x = 0, x = chunk_size - 1, z = 0 and z = chunk_size - 1, in that order
+		*  Neighbour meshes only depend on the facing side
+		*/
+		uint32_t side_revisions[4];
+		PaletteArray blocks;
+		Chunk(int cx, int cz) : blocks(chunk_volume, AIR) { reset(cx, cz); }
+
+		Chunk(const Chunk&) = delete;
+		Chunk& operator=(const Chunk&) = delete;
+
+		/* Move the chunk to other coordinates and clear it, to recycle it */
+		inline void reset(int cx, int cz) {
+			this->cx = cx;
+			this->cz = cz;
+			this->revision = next_revision();
+			this->saved_revision = 0;
+			for (int i = 0; i < 4; i++)
+				side_revisions[i] = next_revision();
+			blocks.fill(AIR);
+		}
+
+		/* Changed since it was saved, or generated */
+		inline bool dirty() const { return revision != saved_revision; }
+
+		inline uint8_t get(int x, int y, int z) const {
+			return blocks.get((y * chunk_size + z) * chunk_size + x);
+		}
+
+		/* Every block, in index order, out holds chunk_volume bytes */
+		inline void read(uint8_t* out) const { blocks.unpack(out); }
+
+		/* Replace every block, in index order */
+		inline void write(const uint8_t* in) {
+			blocks.pack(in);
+			bump(revision);
+			for (int i = 0; i < 4; i++)
+				bump(side_revisions[i]);
+		}
+
+		/* Bytes used by the chunk, blocks included */
+		inline size_t memory() const { return sizeof(Chunk) + blocks.memory(); }
+
+		/* World space bounding box of the chunk blocks */
+		inline void bounds(float min[3], float max[3]) const {
+			min[0] = cx * chunk_size - 0.5f;
+			min[1] = -0.5f;
+			min[2] = cz * chunk_size - 0.5f;
+			max[0] = min[0] + chunk_size;
+			max[1] = min[1] + chunk_height;
+			max[2] = min[2] + chunk_size;
+		}
+
+		inline void set(int x, int y, int z, uint8_t block) {
+			blocks.set((y * chunk_size + z) * chunk_size + x, block);
+			bump(revision);
+			if (x == 0)
+				bump(side_revisions[0]);
+			else if (x == chunk_mask)
+				bump(side_revisions[1]);
+			if (z == 0)
+				bump(side_revisions[2]);
+			else if (z == chunk_mask)
+				bump(side_revisions[3]);
+		}
+
+		/* Make a column solid from the bottom up to height h, clamped to the chunk */
+		inline void fill_column(int x, int z, int h) {
+			h = h < 0 ? 0 : (h >= chunk_height ? chunk_height - 1 : h);
+			for (int y = 0; y <= h; y++)
+				set(x, y, z, GROUND);
+		}
+
+	private:
+		static inline void bump(uint32_t& r) { r = next_revision(); }
+	};
+
+	/* Block change at world coordinates */
+	struct Edit
+	{
+		int x, y, z;
+		uint8_t block;
+	};
+
+	/*
+	* Terrain source, fills chunks on demand
+	* generate is called from background threads, it must be thread safe
+	*/
+	class Generator
+	{
+	public:
+		virtual ~Generator() {}
+		/* Fill an empty chunk, at its cx, cz */
+		virtual void generate(Chunk& chunk) const = 0;
+	};
+
+	/*
+	* Chunk store, chunks are looked up by coordinate in a hash index
+	* so the cost of a lookup does not depend on the world size
+	*/
+	class World
+	{
+	public:
+		unordered_map<uint64_t, Chunk*> chunks;
+
+		~World() {
+			for (auto& it : chunks)
+				delete it.second;
+		}
+
+		/* Find a chunk, nullptr if it does not exist */
+		inline Chunk* chunk(int cx, int cz) const {
+			auto it = chunks.find(chunk_key(cx, cz));
+			return it == chunks.end() ? nullptr : it->second;
+		}
+
+		/* Find a chunk, creating an empty one if needed */
+		inline Chunk* create_chunk(int cx, int cz) {
+			Chunk*& c = chunks[chunk_key(cx, cz)];
+			if (c == nullptr)
+				c = new Chunk(cx, cz);
+			return c;
+		}
+
+		/* Add a chunk, the world takes ownership, false if one already exists there */
+		inline bool insert(Chunk* c) {
+			Chunk*& slot = chunks[chunk_key(c->cx, c->cz)];
+			if (slot != nullptr)
+				return false;
+			slot = c;
+			return true;
+		}
+
+		/* Take a chunk out of the world, the caller owns it, nullptr if it does not exist */
+		inline Chunk* remove(int cx, int cz) {
+			auto it = chunks.find(chunk_key(cx, cz));
+			if (it == chunks.end())
+				return nullptr;
+			Chunk* c = it->second;
+			chunks.erase(it);
+			return c;
+		}
+
+		/* Block at world coordinates, AIR outside of loaded chunks */
+		inline uint8_t get_block(int x, int y, int z) const {
+			if (y < 0 || y >= chunk_height)
+				return AIR;
+			const Chunk* c = chunk(chunk_coord(x), chunk_coord(z));
+			return c ? c->get(local_coord(x), y, local_coord(z)) : AIR;
+		}
+
+		/*
+		*  Change the block at world coordinates, false if the chunk
+		*  is not loaded or y is outside of the world
+		*  Only the chunk, and the neighbour facing it when the block is
+		*  on a side, need their mesh rebuilt
+		*/
+		inline bool set_block(int x, int y, int z, uint8_t block) {
+			if (y < 0 || y >= chunk_height)
+				return false;
+			Chunk* c = chunk(chunk_coord(x), chunk_coord(z));
+			if (c == nullptr)
+				return false;
+			if (c->get(local_coord(x), y, local_coord(z)) != block)
+				c->set(local_coord(x), y, local_coord(z), block);
+			return true;
+		}
+
+		/*
+		*  Apply a batch of edits, sorted by chunk so each chunk is looked
+		*  up once, later edits of the same block win
+		*  Returns the number of edits applied
+		*/
+		int apply(vector<Edit>& edits) {
+			stable_sort(edits.begin(), edits.end(), [](const Edit& a, const Edit& b) {
+				return chunk_key(chunk_coord(a.x), chunk_coord(a.z)) < chunk_key(chunk_coord(b.x), chunk_coord(b.z));
+			});
+			int applied = 0;
+			Chunk* c = nullptr;
+			uint64_t key = 0;
+			for (size_t i = 0; i < edits.size(); i++) {
+				const Edit& e = edits[i];
+				uint64_t k = chunk_key(chunk_coord(e.x), chunk_coord(e.z));
+				if (i == 0 || k != key) {
+					key = k;
+					c = chunk(chunk_coord(e.x), chunk_coord(e.z));
+				}
+				if (c == nullptr || e.y < 0 || e.y >= chunk_height)
+					continue;
+				if (c->get(local_coord(e.x), e.y, local_coord(e.z)) != e.block)
+					c->set(local_coord(e.x), e.y, local_coord(e.z), e.block);
+				applied++;
+			}
+			return applied;
+		}
+
+		/*
+		*  Fill the world from a size^2 heightmap, each column
+		*  is solid from the bottom of the chunk up to its height
+		*/
+		void load_heightmap(const int* map, const int size) {
+			for (int z = 0; z < size; z++) {
+				for (int x = 0; x < size; x++) {
+					Chunk* c = create_chunk(chunk_coord(x), chunk_coord(z));
+					c->fill_column(local_coord(x), local_coord(z), map[z * size + x]);
+				}
+			}
+		}
+
+		/*
+		*  Call f(chunk) for every loaded chunk overlapping the
+		*  [min_x, max_x] x [min_z, max_z] area, O(area) lookups
+		*/
+		template <typename F>
+		inline void for_each_chunk(float min_x, float min_z, float max_x, float max_z, F f) const {
+			int min_cx = chunk_coord((int)floor(min_x)), max_cx = chunk_coord((int)ceil(max_x));
+			int min_cz = chunk_coord((int)floor(min_z)), max_cz = chunk_coord((int)ceil(max_z));
+			for (int cz = min_cz; cz <= max_cz; cz++) {
+				for (int cx = min_cx; cx <= max_cx; cx++) {
+					Chunk* c = chunk(cx, cz);
+					if (c != nullptr)
+						f(c);
+				}
+			}
+		}
+	};
+}